@@ -17,24 +17,29 @@ class ALU {
             } 
             else if(ALU_op == 2) { // R-Type
                 switch(funct) {
-                    case 0x00: ALU_control_inputs = 3; break;               // sll
-                    case 0x02: ALU_control_inputs = 4; break;               // srl
-                    case 0x08: ALU_control_inputs = 2; break;               // don't care
+                    case 0x00: case 0x04: ALU_control_inputs = 3; break;    // sll, sllv
+                    case 0x02: case 0x06: ALU_control_inputs = 4; break;    // srl, srlv
+                    case 0x03: case 0x07: ALU_control_inputs = 10; break;   // sra, srav
+                    case 0x08: case 0x09: ALU_control_inputs = 2; break;    // don't care
                     case 0x20: case 0x21: ALU_control_inputs = 2; break;    // add
                     case 0x22: case 0x23: ALU_control_inputs = 6; break;    // sub
                     case 0x24: ALU_control_inputs = 0; break;               // and
                     case 0x25: ALU_control_inputs = 1; break;               // or
+                    case 0x26: ALU_control_inputs = 9; break;               // xor
                     case 0x27: ALU_control_inputs = 12; break;              // nor
-                    case 0x2a: case 0x2b: ALU_control_inputs = 7; break;    // slt
+                    case 0x2a: ALU_control_inputs = 7; break;               // slt
+                    case 0x2b: ALU_control_inputs = 8; break;               // sltu
                     default: ALU_control_inputs = 2;
                 }
             }
             else { // Other I-type
                 switch(opcode) {
                     case 0x8: case 0x9: ALU_control_inputs = 2; break;      // add
-                    case 0xa: case 0xb: ALU_control_inputs = 7; break;      // slt
+                    case 0xa: ALU_control_inputs = 7; break;                // slt
+                    case 0xb: ALU_control_inputs = 8; break;                // sltu
                     case 0xc: ALU_control_inputs = 0; break;                // and
                     case 0xd: ALU_control_inputs = 1; break;                // or
+                    case 0xe: ALU_control_inputs = 9; break;                // xor
                     case 0xf: ALU_control_inputs = 5; break;                // lui
                     default: ALU_control_inputs = 2;
                 }
@@ -48,11 +53,14 @@ class ALU {
                 case 0: result = operand_1 & operand_2; break;
                 case 1: result = operand_1 | operand_2; break;
                 case 2: result = operand_1 + operand_2; break;
-                case 3: result = operand_2 << operand_1; break;
-                case 4: result = operand_2 >> operand_1; break;
+                case 3: result = operand_2 << (operand_1 & 0x1f); break;
+                case 4: result = operand_2 >> (operand_1 & 0x1f); break;
                 case 5: result = operand_2 << 16; break;
                 case 6: result = operand_1 - operand_2; break;
                 case 7: result = ((int)operand_1 < (int)operand_2) ? 1 : 0; break;
+                case 8: result = (operand_1 < operand_2) ? 1 : 0; break;
+                case 9: result = operand_1 ^ operand_2; break;
+                case 10: result = (int32_t)operand_2 >> (operand_1 & 0x1f); break;
                 case 12: result = ~(operand_1 | operand_2); break;
                 default: result = operand_1 + operand_2; break;
             }
@@ -64,6 +72,44 @@ class ALU {
             }
             return result;
         }
+
+        // mult, multu, div, divu: write the 64-bit product or the remainder/quotient into hi/lo
+        // Division by zero leaves hi and lo unchanged (the result is unpredictable on MIPS)
+        void execute_hilo(int funct, uint32_t operand_1, uint32_t operand_2, uint32_t &hi, uint32_t &lo) {
+            switch(funct) {
+                case 0x18: {
+                    int64_t product = (int64_t)(int32_t)operand_1 * (int32_t)operand_2;
+                    hi = (uint64_t)product >> 32;
+                    lo = (uint32_t)product;
+                    break;
+                }
+                case 0x19: {
+                    uint64_t product = (uint64_t)operand_1 * operand_2;
+                    hi = product >> 32;
+                    lo = (uint32_t)product;
+                    break;
+                }
+                case 0x1a:
+                    if (operand_2 == 0) {
+                        break;
+                    }
+                    if ((int32_t)operand_1 == INT32_MIN && (int32_t)operand_2 == -1) {
+                        hi = 0;
+                        lo = operand_1;
+                        break;
+                    }
+                    hi = (int32_t)operand_1 % (int32_t)operand_2;
+                    lo = (int32_t)operand_1 / (int32_t)operand_2;
+                    break;
+                case 0x1b:
+                    if (operand_2 == 0) {
+                        break;
+                    }
+                    hi = operand_1 % operand_2;
+                    lo = operand_1 / operand_2;
+                    break;
+            }
+        }
             
 };
 #endif
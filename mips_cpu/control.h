@@ -5,6 +5,41 @@
 #include <iostream>
 using namespace std;
 
+// Marker instructions: addiu $zero, $zero, <code> is a no-op on any MIPS core; with --roi the
+// simulator acts on these codes when the instruction retires
+enum MarkerCode {
+    MARKER_NONE,
+    MARKER_ROI_BEGIN,       // simulate in detail from here, with fresh statistics
+    MARKER_ROI_END          // stop simulating this core
+};
+
+// MarkerCode of an instruction, MARKER_NONE for anything but a marker
+inline int marker_code(uint32_t instruction) {
+    uint32_t code = instruction & 0xffff;
+    return (instruction >> 16) == (0x9 << 10) && code <= MARKER_ROI_END ? code : MARKER_NONE;
+}
+
+// Value a load takes from the word holding its address: lb/lbu read the byte and lh/lhu the
+// halfword the low address bits select (little-endian), and lb/lh sign-extend it
+inline uint32_t load_lane(uint32_t word, uint32_t address, bool halfword, bool byte, bool sign) {
+    if (!halfword && !byte) {
+        return word;
+    }
+    uint32_t lane = (word >> 8*(address & (halfword ? 2 : 3))) & (halfword ? 0xffff : 0xff);
+    return !sign ? lane : halfword ? (uint32_t)(int16_t)lane : (uint32_t)(int8_t)lane;
+}
+
+// Word a store leaves in memory: sb/sh replace the byte or halfword at their address and keep
+// the rest of the word
+inline uint32_t store_lane(uint32_t word, uint32_t data, uint32_t address, bool halfword, bool byte) {
+    if (!halfword && !byte) {
+        return data;
+    }
+    int shift = 8*(address & (halfword ? 2 : 3));
+    uint32_t mask = (halfword ? 0xffffu : 0xffu) << shift;
+    return (word & ~mask) | ((data << shift) & mask);
+}
+
 // Control signals for the processor
 struct control_t {
     bool reg_dest;           // 0 if rt, 1 if rd
@@ -23,6 +58,10 @@ struct control_t {
     bool ALU_src;            // 0 if second operand is from reg_file, 1 if imm
     bool reg_write;          // 1 if need to write back to reg file
     bool zero_extend;        // 1 if immediate needs to be zero-extended
+    bool mul_div;            // 1 if mult, multu, div or divu (writes HI/LO)
+    bool move_hilo;          // 1 if mfhi or mflo
+    bool load_signed;        // 1 if lb or lh (sign-extend the loaded byte/halfword)
+    int marker;              // MarkerCode, MARKER_NONE for ordinary instructions
     
     void print() {      // Prints the generated contol signals
         cout << "REG_DEST: " << reg_dest << "\n";
@@ -52,7 +91,10 @@ struct control_t {
         ALU_src = 0;           
         reg_write = 0;          
         zero_extend = 0;        
-
+        mul_div = 0;
+        move_hilo = 0;
+        load_signed = 0;
+        marker = MARKER_NONE;
     }
     // Decode instructions into control signals
     void decode(uint32_t instruction) {
@@ -74,10 +116,29 @@ struct control_t {
                 jump_reg = 1;
             }
 
-            // Special Case: shift
-            if ((instruction & 0x3f) == 0x0 || (instruction & 0x3f) == 0x2) {
+            // Special Case: jalr, links into rd
+            if ((instruction & 0x3f) == 0x09) {
+                ALU_op = 0;
+                jump = 1;
+                jump_reg = 1;
+                link = 1;
+            }
+
+            // Special Case: shift by shamt (variable shifts take the amount from rs)
+            if ((instruction & 0x3f) == 0x0 || (instruction & 0x3f) == 0x2 || (instruction & 0x3f) == 0x3) {
                 shift = 1;
             }
+
+            // Special Case: mult, multu, div, divu only write HI/LO
+            if ((instruction & 0x3f) >= 0x18 && (instruction & 0x3f) <= 0x1b) {
+                reg_write = 0;
+                mul_div = 1;
+            }
+
+            // Special Case: mfhi, mflo
+            if ((instruction & 0x3f) == 0x10 || (instruction & 0x3f) == 0x12) {
+                move_hilo = 1;
+            }
         } // end R-Type
         
         else if (opcode == 0x2 || opcode == 0x3) { // J-Type Instructions
@@ -116,27 +177,33 @@ struct control_t {
                 }
             } // end stores
 
-            else if ((opcode >= 0x23 && opcode <= 0x25) || opcode == 0x30) { // Loads
+            else if ((opcode >= 0x20 && opcode <= 0x25 && opcode != 0x22) || opcode == 0x30) { // Loads
                 mem_read = 1;
                 mem_to_reg = 1;
                 reg_write = 1;
                 
-                // Special Case: lbu, lhu
-                if (opcode == 0x24) { // lbu
+                // Special Case: lb, lh, lbu, lhu
+                if (opcode == 0x20 || opcode == 0x24) { // lb, lbu
                     byte = 1;
                 }
-                else if (opcode == 0x25) { // lhu
+                else if (opcode == 0x21 || opcode == 0x25) { // lh, lhu
                     halfword = 1;
                 }
+                load_signed = opcode == 0x20 || opcode == 0x21;
             } // end loads
 
             else { // Catch all I-type Instrcutions
                 reg_write = 1;
                 ALU_op = 3; 
-                // Special Case: ori, andi
-                if (opcode == 0xc || opcode == 0xd) {
+                // Special Case: andi, ori, xori
+                if (opcode == 0xc || opcode == 0xd || opcode == 0xe) {
                     zero_extend = 1;
                 }
+                // Special Case: markers write nothing, $zero keeps its value
+                marker = marker_code(instruction);
+                if (marker) {
+                    reg_write = 0;
+                }
             }
 
         }// end I-Type
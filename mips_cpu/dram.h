@@ -0,0 +1,173 @@
+#ifndef DRAM
+#define DRAM
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <iostream>
+
+// Timing of the DRAM behind the last cache level, in processor cycles
+struct DramConfig {
+    int banks;                   // 0 disables the model: memory costs the last level's miss penalty
+    int rowSize;                 // bytes of one row in a bank; consecutive rows rotate over the banks
+    int tRCD;                    // activate to column command
+    int tCAS;                    // column command to data
+    int tRP;                     // precharge
+    int burst;                   // bus cycles to transfer one line
+    bool openPage;               // 0: closed-page, rows are precharged after every access
+    int queueSize;               // pending requests the controller accepts
+};
+
+struct DramStats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t rowHits;            // column access to the open row
+    uint64_t rowMisses;          // bank was precharged, activate first
+    uint64_t rowConflicts;       // another row was open, precharge and activate first
+    uint64_t queueFull;          // demand reads turned away by a full request queue
+    uint64_t readLatency;        // cycles from arrival to data, summed over reads
+};
+
+// DRAM controller with per-bank row buffers and a shared data bus. Requests wait in one queue
+// and are scheduled FR-FCFS: requests to an open row first, then the oldest, one command per cycle.
+// Demand reads are tracked per requester port; writes are posted and only occupy banks and the bus.
+class Dram {
+    private:
+        struct Request {
+            uint32_t address;
+            bool write;
+            int port;                        // requester waiting for the data, -1 for posted writes
+            uint64_t arrival;
+        };
+        enum { NONE = -2, QUEUED = -1 };
+
+        DramConfig config;
+        std::deque<Request> queue;
+        std::vector<int64_t> openRow;        // per bank, -1 when precharged
+        std::vector<uint64_t> bankReady;     // cycle each bank accepts its next command
+        uint64_t busReady;                   // cycle the data bus is free
+        uint64_t lastIssue;                  // cycle of the last command (one per cycle)
+        std::vector<int64_t> portDone;       // per port: NONE, QUEUED or the cycle its data arrives
+        DramStats stats;
+
+        int getBank(uint32_t address) { return (address / config.rowSize) % config.banks; }
+        int64_t getRow(uint32_t address) { return address / config.rowSize / config.banks; }
+
+        bool isRowHit(const Request &r) {
+            return openRow[getBank(r.address)] == getRow(r.address);
+        }
+
+        // Send the commands for one request to its bank and the bus
+        void issue(const Request &r, uint64_t now) {
+            int bank = getBank(r.address);
+            int access = config.tCAS;
+            if (openRow[bank] == getRow(r.address)) {
+                stats.rowHits++;
+            } else if (openRow[bank] < 0) {
+                stats.rowMisses++;
+                access += config.tRCD;
+            } else {
+                stats.rowConflicts++;
+                access += config.tRP + config.tRCD;
+            }
+            uint64_t start = std::max(now + access, busReady);
+            busReady = start + config.burst;
+            if (config.openPage) {
+                openRow[bank] = getRow(r.address);
+                bankReady[bank] = now + access - config.tCAS + config.burst;
+            } else {
+                openRow[bank] = -1;
+                bankReady[bank] = busReady + config.tRP;
+            }
+            lastIssue = now;
+            if (r.write) {
+                stats.writes++;
+            } else {
+                stats.reads++;
+                stats.readLatency += busReady - r.arrival;
+                if (r.port >= 0) {
+                    portDone[r.port] = busReady;
+                }
+            }
+        }
+
+        void enqueue(uint32_t address, bool write, int port, uint64_t now) {
+            queue.push_back({address, write, port, now});
+            tick(now);
+        }
+    public:
+        Dram() : busReady(0), lastIssue(~0ull) {
+            config.banks = 0;
+            stats = DramStats();
+        }
+
+        void configure(const DramConfig &c, int num_ports) {
+            config = c;
+            openRow.assign(c.banks, -1);
+            bankReady.assign(c.banks, 0);
+            portDone.assign(num_ports, NONE);
+        }
+        bool enabled() { return config.banks > 0; }
+
+        // Check if a port has a read in flight (queued or waiting for its data)
+        bool busy(int port) { return portDone[port] != NONE; }
+
+        // Queue a demand read for a port, returns false if the queue is full
+        bool read(uint32_t address, int port, uint64_t now) {
+            if ((int)queue.size() >= config.queueSize) {
+                stats.queueFull++;
+                return false;
+            }
+            portDone[port] = QUEUED;
+            enqueue(address, false, port, now);
+            return true;
+        }
+
+        // Queue a request nobody waits for (writebacks, stores, background fills);
+        // these are never refused and may push the queue past its size
+        void post(uint32_t address, bool write, uint64_t now) {
+            enqueue(address, write, -1, now);
+        }
+
+        // Check if the read of a port delivers its data by the next cycle, and retire it if so
+        bool done(int port, uint64_t now) {
+            if (portDone[port] < 0 || (uint64_t)portDone[port] > now + 1) {
+                return false;
+            }
+            portDone[port] = NONE;
+            return true;
+        }
+
+        // Issue at most one request per cycle: row hits first, then the oldest
+        void tick(uint64_t now) {
+            if (lastIssue == now) {
+                return;
+            }
+            int pick = -1;
+            for (int i = 0; i < (int)queue.size(); i++) {
+                if (bankReady[getBank(queue[i].address)] > now) {
+                    continue;
+                }
+                if (pick < 0 || (config.openPage && isRowHit(queue[i]) && !isRowHit(queue[pick]))) {
+                    pick = i;
+                }
+            }
+            if (pick < 0) {
+                return;
+            }
+            issue(queue[pick], now);
+            queue.erase(queue.begin() + pick);
+        }
+
+        void resetStats() { stats = DramStats(); }
+
+        void printStats() {
+            std::cout << "DRAM reads: " << stats.reads << " writes: " << stats.writes
+                      << " row hits: " << stats.rowHits << " row misses: " << stats.rowMisses
+                      << " row conflicts: " << stats.rowConflicts << " queue full: " << stats.queueFull;
+            if (stats.reads) {
+                std::cout << " avg read latency: " << (double)stats.readLatency / stats.reads;
+            }
+            std::cout << "\n";
+        }
+};
+#endif
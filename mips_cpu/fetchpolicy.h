@@ -0,0 +1,68 @@
+#ifndef FETCH_POLICY
+#define FETCH_POLICY
+#include <vector>
+#include <cstdint>
+#include "processor.h"
+
+// How a core with several hardware contexts hands out its fetch slot
+enum FetchPolicy {
+    FETCH_ROUND_ROBIN,      // the next live context every cycle (barrel)
+    FETCH_SWITCH_ON_MISS,   // stay with one context until it waits for the L1I or L1D
+    FETCH_ICOUNT            // the context with the fewest instructions fetched but not executed
+};
+
+/* Fetch arbitration of one core: before every cycle, grants the fetch slot to one of its
+   hardware contexts that is still running. The contexts keep their own register file, PC and
+   pipeline latches and share the core's L1s, so a context waiting for memory leaves the slot
+   to the others. */
+class FetchArbiter {
+    private:
+        FetchPolicy policy;
+        std::vector<Processor *> contexts;
+        int current;                // context granted last
+        uint64_t memoryStalls;      // its memory stall count then
+
+        // Next live context after current in round-robin order, -1 if none is live
+        template <class Live>
+        int next(Live live) {
+            int n = contexts.size();
+            for (int i = 1; i <= n; i++) {
+                int c = (current + i) % n;
+                if (live(*contexts[c])) {
+                    return c;
+                }
+            }
+            return -1;
+        }
+    public:
+        FetchArbiter(FetchPolicy p, const std::vector<Processor *> &ctxs) :
+            policy(p), contexts(ctxs), current(ctxs.size()-1), memoryStalls(0) {}
+
+        // Grant the slot for this cycle; live tells whether a context still runs
+        template <class Live>
+        void select(Live live) {
+            int pick = next(live);
+            if (policy == FETCH_SWITCH_ON_MISS && live(*contexts[current])) {
+                Processor &p = *contexts[current];
+                if (!p.fetchMissPending() && p.getStats().memoryStalls == memoryStalls) {
+                    pick = current;
+                }
+            } else if (policy == FETCH_ICOUNT && pick >= 0) {
+                int n = contexts.size();
+                for (int i = 1; i <= n; i++) {
+                    int c = (pick + i) % n;
+                    if (live(*contexts[c]) && contexts[c]->instructionCount() < contexts[pick]->instructionCount()) {
+                        pick = c;
+                    }
+                }
+            }
+            for (int c = 0; c < (int)contexts.size(); c++) {
+                contexts[c]->setFetchGrant(c == pick);
+            }
+            if (pick >= 0) {
+                current = pick;
+                memoryStalls = contexts[current]->getStats().memoryStalls;
+            }
+        }
+};
+#endif
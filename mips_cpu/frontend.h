@@ -0,0 +1,155 @@
+#ifndef FRONTEND
+#define FRONTEND
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include "memory.h"
+
+// An instruction handed from the front end to decode, with the address fetch continued at
+struct FetchEntry {
+    uint32_t instruction;
+    uint32_t pc;
+    uint32_t next_pc;
+};
+
+struct FrontEndStats {
+    uint64_t fetched;            // instructions read from the L1I
+    uint64_t replayed;           // instructions supplied by the loop buffer
+    uint64_t empty;              // cycles decode found the instruction buffer empty
+    uint64_t redirects;          // flushes of the buffer by mispredicted branches and jumps
+};
+
+// Decoupled front end: fetch runs ahead of decode into an instruction buffer, up to width
+// words of an aligned fetch block per cycle, and keeps going while the back end stalls.
+// Fetch follows sequential addresses except inside a captured loop: a taken backward branch
+// over at most loopSize instructions trains the loop buffer, the body is captured as it is
+// fetched next, and from then on the loop is replayed from the buffer (predicting the
+// backward branch taken) without touching the L1I. Stores into a captured loop body are not
+// detected.
+class FrontEnd {
+    private:
+        Memory *memory;
+        int core;
+        int queueSize;
+        int width;
+        int loopSize;
+        std::deque<FetchEntry> queue;
+        uint32_t pc;                        // next fetch address
+
+        uint32_t loopStart;                 // first instruction of the loop body
+        uint32_t loopEnd;                   // the backward branch
+        std::vector<uint32_t> loopBody;
+        std::vector<bool> captured;
+        bool loopValid;                     // body fully captured, replaying
+        bool missed;                        // the last L1I access missed, the refill is pending
+        FrontEndStats stats;
+
+        bool inLoop(uint32_t addr) {
+            return loopSize && addr >= loopStart && addr <= loopEnd && loopStart != loopEnd;
+        }
+    public:
+        FrontEnd() : memory(nullptr), core(0), queueSize(0), width(1), loopSize(0), pc(0),
+                     loopStart(0), loopEnd(0), loopValid(false), missed(false) {
+            stats = FrontEndStats();
+        }
+
+        void configure(Memory *mem, int core_id, int entries, int fetch_width, int loop_entries) {
+            memory = mem;
+            core = core_id;
+            queueSize = entries;
+            width = fetch_width;
+            loopSize = loop_entries;
+        }
+        bool enabled() { return queueSize > 0; }
+        int size() { return queue.size(); }
+
+        // An L1I miss is outstanding: the front end keeps asking for the line even without
+        // a fetch slot (see Processor::setFetchGrant)
+        bool missPending() { return missed; }
+
+        void resetStats() { stats = FrontEndStats(); }
+
+        // Fetch the rest of the current fetch block into the buffer, as far as it has room
+        void tick() {
+            for (int i = 0; i < width && (int)queue.size() < queueSize; i++) {
+                uint32_t fetched = pc;
+                if (!fetchOne() || pc != fetched + 4 || pc % (4*width) == 0) {
+                    return;
+                }
+            }
+        }
+
+        // Fetch one instruction, from the loop buffer when replaying; false on an L1I miss
+        bool fetchOne() {
+            uint32_t instruction;
+            if (loopValid && inLoop(pc)) {
+                instruction = loopBody[(pc - loopStart)/4];
+                uint32_t next = pc == loopEnd ? loopStart : pc + 4;
+                queue.push_back({instruction, pc, next});
+                stats.replayed++;
+                pc = next;
+                return true;
+            }
+            missed = !memory->fetch(pc, instruction, core);
+            if (missed) {
+                return false;
+            }
+            stats.fetched++;
+            if (inLoop(pc)) {
+                loopBody[(pc - loopStart)/4] = instruction;
+                captured[(pc - loopStart)/4] = true;
+                loopValid = std::find(captured.begin(), captured.end(), false) == captured.end();
+            }
+            queue.push_back({instruction, pc, pc + 4});
+            pc += 4;
+            return true;
+        }
+
+        // Hand the oldest buffered instruction to decode, false if the buffer is empty
+        bool pop(FetchEntry &entry) {
+            if (queue.empty()) {
+                stats.empty++;
+                return false;
+            }
+            entry = queue.front();
+            queue.pop_front();
+            return true;
+        }
+
+        // The instruction decode would get next, false if the buffer is empty
+        bool peek(FetchEntry &entry) {
+            if (queue.empty()) {
+                return false;
+            }
+            entry = queue.front();
+            return true;
+        }
+
+        // A branch or jump went elsewhere than fetch assumed: drop the buffer and refetch
+        void redirect(uint32_t target) {
+            queue.clear();
+            pc = target;
+            stats.redirects++;
+        }
+
+        // A taken branch or jump resolved: backward ones over a short body train the loop buffer
+        void train(uint32_t branch_pc, uint32_t target) {
+            if (!loopSize || target > branch_pc || (int)((branch_pc - target)/4) + 1 > loopSize ||
+                (target == loopStart && branch_pc == loopEnd)) {
+                return;
+            }
+            loopStart = target;
+            loopEnd = branch_pc;
+            loopBody.assign((branch_pc - target)/4 + 1, 0);
+            captured.assign(loopBody.size(), false);
+            loopValid = false;
+        }
+
+        void printStats() {
+            std::cout << "Front end fetched: " << stats.fetched << " replayed: " << stats.replayed
+                      << " buffer empty: " << stats.empty << " redirects: " << stats.redirects << "\n";
+        }
+};
+#endif
@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "hostprof.h"
+
+using namespace std;
+
+#ifdef HOST_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+uint64_t HostTimer::hostTicks() { return __rdtsc(); }
+#else
+uint64_t HostTimer::hostTicks() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static const char *component_names[HOST_COMPONENTS] = {
+    "fetch", "decode", "execute", "memory stage", "writeback",
+    "Cache::isHit", "Cache::replace", "Memory::access", "output"
+};
+
+struct HostProfile {
+    uint64_t ticks[HOST_COMPONENTS];
+    uint64_t calls[HOST_COMPONENTS];
+
+    void add(const HostProfile &p) {
+        for (int c = 0; c < HOST_COMPONENTS; c++) {
+            ticks[c] += p.ticks[c];
+            calls[c] += p.calls[c];
+        }
+    }
+};
+
+// Each host thread counts into its own profile; they are summed for the report, and those
+// of threads that exited are kept in finished
+static mutex profile_lock;
+static HostProfile finished;
+static vector<HostProfile *> running;
+
+struct ThreadProfile : HostProfile {
+    ThreadProfile() {
+        memset(ticks, 0, sizeof(ticks));
+        memset(calls, 0, sizeof(calls));
+        lock_guard<mutex> guard(profile_lock);
+        running.push_back(this);
+    }
+    ~ThreadProfile() {
+        lock_guard<mutex> guard(profile_lock);
+        finished.add(*this);
+        running.erase(find(running.begin(), running.end(), this));
+    }
+};
+static thread_local ThreadProfile thread_profile;
+static thread_local HostTimer *innermost = nullptr;
+
+HostTimer::HostTimer(int c) : parent(innermost), component(c), start(hostTicks()), children(0) {
+    innermost = this;
+}
+
+HostTimer::~HostTimer() {
+    charge(hostTicks());
+    innermost = parent;
+}
+
+void HostTimer::charge(uint64_t now) {
+    uint64_t elapsed = now - start;
+    thread_profile.ticks[component] += elapsed - children;
+    thread_profile.calls[component]++;
+    if (parent) {
+        parent->children += elapsed;
+    }
+    children = 0;
+}
+
+static uint64_t run_ticks;
+static chrono::steady_clock::time_point run_start;
+
+void host_profile_start() {
+    run_start = chrono::steady_clock::now();
+    run_ticks = HostTimer::hostTicks();
+}
+
+bool host_profile_print() {
+    uint64_t total = HostTimer::hostTicks() - run_ticks;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - run_start).count();
+    double ns_per_tick = total ? seconds * 1e9 / total : 0;
+
+    HostProfile sum = finished;
+    {
+        lock_guard<mutex> guard(profile_lock);
+        for (HostProfile *p : running) {
+            sum.add(*p);
+        }
+    }
+    uint64_t profiled = 0;
+    printf("\nHost profile: %.3f s\n", seconds);
+    printf("%-16s %12s %7s %14s %10s\n", "component", "ms", "%", "calls", "ns/call");
+    for (int c = 0; c < HOST_COMPONENTS; c++) {
+        profiled += sum.ticks[c];
+        printf("%-16s %12.3f %6.1f%% %14llu %10.1f\n", component_names[c], sum.ticks[c] * ns_per_tick / 1e6,
+               total ? 100.0 * sum.ticks[c] / total : 0, (unsigned long long)sum.calls[c],
+               sum.calls[c] ? sum.ticks[c] * ns_per_tick / sum.calls[c] : 0);
+    }
+    // loop control, sampling and host threading
+    uint64_t other = total > profiled ? total - profiled : 0;
+    printf("%-16s %12.3f %6.1f%%\n", "other", other * ns_per_tick / 1e6, total ? 100.0 * other / total : 0);
+    return true;
+}
+#else
+void host_profile_start() {}
+
+bool host_profile_print() { return false; }
+#endif
@@ -0,0 +1,63 @@
+#ifndef HOSTPROF
+#define HOSTPROF
+#include <cstdint>
+
+// Parts of the simulator whose host time --host-profile reports
+enum HostComponent {
+    HOST_FETCH,
+    HOST_DECODE,
+    HOST_EXECUTE,
+    HOST_MEMORY_STAGE,
+    HOST_WRITEBACK,
+    HOST_CACHE_LOOKUP,      // Cache::isHit
+    HOST_CACHE_REPLACE,     // Cache::replace
+    HOST_MEMORY_ACCESS,     // Memory::access/fetch outside the two above
+    HOST_OUTPUT,            // per-cycle trace and final register dump
+    HOST_COMPONENTS
+};
+
+/* Host-time profile of the simulator, compiled in with -DHOST_PROFILE (make HOST_PROFILE=1).
+   Timers read the TSC; each charges the time it was innermost to its component, so the
+   components add up without double counting (a cache lookup is not also MEM stage time).
+   HOST_PROFILE_STAGES starts a timer whose component HOST_PROFILE_STAGE switches as a
+   function moves through the pipeline stages; it closes at any return. Without
+   HOST_PROFILE the macros expand to nothing. */
+#ifdef HOST_PROFILE
+class HostTimer {
+    private:
+        HostTimer *parent;
+        int component;
+        uint64_t start;
+        uint64_t children;      // time of nested timers since start
+
+        void charge(uint64_t now);
+    public:
+        HostTimer(int c);
+        ~HostTimer();
+
+        // Charge the time so far to the current component and go on timing c
+        void enter(int c) {
+            uint64_t now = hostTicks();
+            charge(now);
+            component = c;
+            start = now;
+        }
+
+        static uint64_t hostTicks();
+};
+
+#define HOST_PROFILE_SCOPE(c) HostTimer host_timer(c)
+#define HOST_PROFILE_STAGES(c) HostTimer host_stages(c)
+#define HOST_PROFILE_STAGE(c) host_stages.enter(c)
+#else
+#define HOST_PROFILE_SCOPE(c)
+#define HOST_PROFILE_STAGES(c)
+#define HOST_PROFILE_STAGE(c)
+#endif
+
+// Start measuring the run (wall time the components are compared against)
+void host_profile_start();
+
+// Print the time per component, false if the profile is not compiled in
+bool host_profile_print();
+#endif
@@ -0,0 +1,136 @@
+#ifndef INTERVAL
+#define INTERVAL
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "processor.h"
+
+// Counters at the start of the current interval, per core
+struct IntervalSnapshot {
+    CoreStats core;
+    CacheStats l1i;
+    CacheStats l1d;
+    CacheStats l2;
+};
+
+/* Interval statistics: every period cycles (or retired instructions, summed over the cores)
+   writes one sample per core with the IPC, L1I/L1D/L2 miss rates, stall cycles by cause and
+   mispredicts of the interval, as CSV or JSON lines. The file is streamed as the run goes.
+   The L2 columns are those of the first shared level, which all cores share. */
+class IntervalSampler {
+    private:
+        FILE *out;
+        std::vector<Processor> *cores;
+        Memory *memory;
+        bool json;
+        bool byInstructions;
+        uint64_t period;
+        uint64_t next;              // cycle or instruction count of the next sample
+        uint64_t index;
+        uint64_t start;             // cycle the interval began
+        std::vector<IntervalSnapshot> last;
+
+        // Misses per access: a cache counts one miss per refill, and no hit for the access it completes
+        static double rate(uint64_t misses, uint64_t hits) {
+            return misses + hits ? (double)misses / (misses + hits) : 0;
+        }
+
+        IntervalSnapshot snapshot(Processor &core) {
+            IntervalSnapshot s;
+            s.core = core.getStats();
+            s.l1i = memory->getL1IStats(core.getCoreId());
+            s.l1d = memory->getL1DStats(core.getCoreId());
+            s.l2 = memory->numLevels() ? memory->getLevelStats(0) : CacheStats();
+            return s;
+        }
+
+        uint64_t retired() {
+            uint64_t n = 0;
+            for (Processor &c : *cores) {
+                n += c.getStats().retired;
+            }
+            return n;
+        }
+    public:
+        IntervalSampler() : out(nullptr), cores(nullptr), memory(nullptr), json(false), byInstructions(false), period(0), next(UINT64_MAX), index(0), start(0) {}
+        ~IntervalSampler() { close(); }
+
+        // Sample every period cycles, or instructions; JSON lines if the path ends in .json/.jsonl
+        bool open(const char *path, uint64_t interval, bool instructions, std::vector<Processor> &sampled, Memory &mem) {
+            out = fopen(path, "w");
+            if (!out) {
+                return false;
+            }
+            std::string p = path;
+            json = p.size() >= 5 && (p.compare(p.size() - 5, 5, ".json") == 0 || (p.size() >= 6 && p.compare(p.size() - 6, 6, ".jsonl") == 0));
+            byInstructions = instructions;
+            period = interval;
+            next = interval;
+            cores = &sampled;
+            memory = &mem;
+            last.assign(sampled.size(), IntervalSnapshot());
+            if (!json) {
+                fprintf(out, "interval,core,start_cycle,end_cycle,instructions,ipc,l1i_miss_rate,l1d_miss_rate,l2_miss_rate,"
+                             "fetch_stalls,memory_stalls,interlocks,mispredicts\n");
+            }
+            return true;
+        }
+        bool enabled() { return out != nullptr; }
+
+        // Called once per simulated cycle, after cycle number cycle has completed
+        void tick(uint64_t cycle) {
+            if ((byInstructions ? retired() : cycle) >= next) {
+                sample(cycle);
+                next += period;
+            }
+        }
+
+        // Write the samples of the interval ending after this cycle and start the next one
+        void sample(uint64_t cycle) {
+            for (int c = 0; c < (int)cores->size(); c++) {
+                IntervalSnapshot now = snapshot((*cores)[c]);
+                IntervalSnapshot &was = last[c];
+                uint64_t insts = now.core.retired - was.core.retired;
+                uint64_t cycles = cycle - start;
+                double ipc = cycles ? (double)insts / cycles : 0;
+                double l1i = rate(now.l1i.misses - was.l1i.misses, now.l1i.hits - was.l1i.hits);
+                double l1d = rate(now.l1d.misses - was.l1d.misses, now.l1d.hits - was.l1d.hits);
+                double l2 = rate(now.l2.misses - was.l2.misses, now.l2.hits - was.l2.hits);
+                unsigned long long fetch = now.core.fetchStalls - was.core.fetchStalls;
+                unsigned long long mem = now.core.memoryStalls - was.core.memoryStalls;
+                unsigned long long inter = now.core.interlocks - was.core.interlocks;
+                unsigned long long mispredicts = now.core.mispredicts - was.core.mispredicts;
+                if (json) {
+                    fprintf(out, "{\"interval\":%llu,\"core\":%d,\"start_cycle\":%llu,\"end_cycle\":%llu,\"instructions\":%llu,"
+                                 "\"ipc\":%.4f,\"l1i_miss_rate\":%.4f,\"l1d_miss_rate\":%.4f,\"l2_miss_rate\":%.4f,"
+                                 "\"fetch_stalls\":%llu,\"memory_stalls\":%llu,\"interlocks\":%llu,\"mispredicts\":%llu}\n",
+                            (unsigned long long)index, c, (unsigned long long)start, (unsigned long long)cycle,
+                            (unsigned long long)insts, ipc, l1i, l1d, l2, fetch, mem, inter, mispredicts);
+                } else {
+                    fprintf(out, "%llu,%d,%llu,%llu,%llu,%.4f,%.4f,%.4f,%.4f,%llu,%llu,%llu,%llu\n",
+                            (unsigned long long)index, c, (unsigned long long)start, (unsigned long long)cycle,
+                            (unsigned long long)insts, ipc, l1i, l1d, l2, fetch, mem, inter, mispredicts);
+                }
+                was = now;
+            }
+            index++;
+            start = cycle;
+        }
+
+        // Write the partial interval at the end of the run
+        void finish(uint64_t cycle) {
+            if (out && cycle > start) {
+                sample(cycle);
+            }
+            close();
+        }
+
+        void close() {
+            if (out) {
+                fclose(out);
+                out = nullptr;
+            }
+        }
+};
+#endif
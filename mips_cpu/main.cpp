@@ -10,7 +10,14 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <getopt.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "processor.h"
+#include "fetchpolicy.h"
+#include "interval.h"
+#include "hostprof.h"
 
 using namespace std;
 
@@ -19,7 +26,7 @@ extern void pipelined_main_loop(Registers &reg_file, Memory &memory, uint32_t en
 extern void processor_main_loop(Registers &reg_file, Memory &memory, uint32_t end_pc, int width);
 
 /* Load Binary. */
-uint32_t load(char *bmk, Memory &memory)
+uint32_t load(char *bmk, Memory &memory, int core = 0)
 {
   Elf32_Ehdr ehdr;
   Elf32_Shdr shdr;
@@ -28,7 +35,7 @@ uint32_t load(char *bmk, Memory &memory)
   FILE *binary, *binary_copy;
   binary = fopen(bmk, "r");
   if (!binary) {
-      cout << "Failed to open executable binary: " << string(optarg) << "\n";
+      cout << "Failed to open executable binary: " << string(bmk) << "\n";
       return 0;
   }
 
@@ -58,7 +65,7 @@ uint32_t load(char *bmk, Memory &memory)
                           ": bytes read=" << j + num_read << ", section header size=" << shdr.sh_size << "\n";
                   return 0;
               }
-              memory.access((uint32_t)shdr.sh_addr+j, dummy_word, word, false, true);
+              memory.access((uint32_t)shdr.sh_addr+j, dummy_word, word, false, true, core);
           }
           fclose(binary_copy);
           return shdr.sh_size;
@@ -68,6 +75,420 @@ uint32_t load(char *bmk, Memory &memory)
   return 0;
 }
 
+// Why a core stopped before passing its last instruction
+enum StopReason { RUNNING, STOP_ROI_END, STOP_MAX_INSTS, STOP_MAX_CYCLES };
+
+/* Ends of a run before the last instruction: with --roi a core stops when it retires the end
+   marker, and --max-insts/--max-cycles stop it once it has retired or spent that many in the
+   measured region. Checked after every cycle of a core, by the thread simulating it. */
+struct RunLimits {
+    bool roi;
+    uint64_t maxInsts;          // 0: no limit
+    uint64_t maxCycles;
+    vector<int> stopped;        // StopReason per core
+
+    bool enabled() { return roi || maxInsts || maxCycles; }
+
+    bool running(Processor &p, uint32_t end_pc) { return p.getPC() <= end_pc && !stopped[p.getCoreId()]; }
+
+    void check(Processor &p) {
+        const CoreStats &s = p.getStats();
+        int reason = roi && p.takeMarker() == MARKER_ROI_END ? STOP_ROI_END :
+                     maxInsts && s.retired >= maxInsts ? STOP_MAX_INSTS :
+                     maxCycles && s.cycles >= maxCycles ? STOP_MAX_CYCLES : RUNNING;
+        stopped[p.getCoreId()] = reason;
+    }
+};
+
+/* Run the cores functionally (single-cycle model, no caches, no trace), one instruction each
+   in turn, until every core has retired the ROI begin marker or passed its last instruction.
+   Returns whether the core entered the region of interest, per core. */
+vector<bool> fast_forward(vector<Processor> &cores, vector<uint32_t> &end_pc)
+{
+    vector<bool> entered(cores.size(), false);
+    bool running = true;
+    while (running) {
+        running = false;
+        for (int c = 0; c < (int)cores.size(); c++) {
+            if (entered[c] || cores[c].getPC() > end_pc[c]) {
+                continue;
+            }
+            cores[c].advance<SINGLE_CYCLE, NoTrace>();
+            entered[c] = cores[c].takeMarker() == MARKER_ROI_BEGIN;
+            running = true;
+        }
+    }
+    return entered;
+}
+
+/* Synchronizes host threads at the end of every simulated cycle quantum. */
+class QuantumBarrier {
+    private:
+        std::mutex m;
+        std::condition_variable cv;
+        int count;
+        int waiting;
+        unsigned generation;
+        bool active;
+        bool result;
+    public:
+        QuantumBarrier(int n) : count(n), waiting(0), generation(0), active(false), result(false) {}
+
+        // Blocks until all threads arrive, returns true if any thread still has a running core
+        bool wait(bool still_running) {
+            std::unique_lock<std::mutex> lk(m);
+            unsigned gen = generation;
+            active |= still_running;
+            if (++waiting == count) {
+                result = active;
+                active = false;
+                waiting = 0;
+                generation++;
+                cv.notify_all();
+                return result;
+            }
+            cv.wait(lk, [&] { return gen != generation; });
+            return result;
+        }
+};
+
+/* Simulate the cores on several host threads, each owning every num_threads-th core (with all
+   of its hardware contexts). Threads run quantum cycles independently and then meet at a barrier,
+   so cores never drift apart by more than one quantum. Returns the cycle count of the slowest core.
+   There is no per-cycle trace. */
+template <TimingModel Model>
+uint64_t parallel_main_loop(vector<Processor> &cores, vector<uint32_t> &end_pc, int num_threads, int quantum, RunLimits &limits,
+                            vector<FetchArbiter> &arbiters)
+{
+    bool limited = limits.enabled();
+    int group = arbiters.empty() ? 1 : cores.size() / arbiters.size();
+    auto live = [&](Processor &p) { return limits.running(p, end_pc[p.getCoreId()]); };
+    vector<uint64_t> core_cycles(cores.size(), 0);
+    QuantumBarrier barrier(num_threads);
+    vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t] {
+            bool running = true;
+            while (running) {
+                bool mine_running = false;
+                for (int q = 0; q < quantum; q++) {
+                    mine_running = false;
+                    for (int k = t; k < (int)cores.size() / group; k += num_threads) {
+                        if (!arbiters.empty()) {
+                            arbiters[k].select(live);
+                        }
+                        for (int c = k * group; c < (k + 1) * group; c++) {
+                            if (limits.running(cores[c], end_pc[c])) {
+                                cores[c].advance<Model, NoTrace>();
+                                if (limited) {
+                                    limits.check(cores[c]);
+                                }
+                                core_cycles[c]++;
+                                mine_running = true;
+                            }
+                        }
+                    }
+                    if (!mine_running) {
+                        break;
+                    }
+                }
+                running = barrier.wait(mine_running);
+            }
+        }));
+    }
+    for (int t = 0; t < num_threads; t++) {
+        threads[t].join();
+    }
+
+    uint64_t num_cycles = 0;
+    for (int c = 0; c < (int)cores.size(); c++) {
+        num_cycles = max(num_cycles, core_cycles[c]);
+    }
+    return num_cycles;
+}
+
+/* Simulate the cores on this thread until all of them pass their last instruction or stop,
+   printing the trace every cycle and feeding the interval sampler if it is enabled. With
+   hardware contexts, the arbiters hand out the fetch slots before each cycle. Returns the
+   number of cycles. */
+template <TimingModel Model, class Trace>
+uint64_t main_loop(vector<Processor> &cores, vector<uint32_t> &end_pc, IntervalSampler &sampler, RunLimits &limits,
+                   vector<FetchArbiter> &arbiters)
+{
+    bool sampling = sampler.enabled();
+    bool limited = limits.enabled();
+    int num_cores = cores.size();
+    uint64_t num_cycles = 0;
+    if (num_cores == 1) {
+        Processor &processor = cores[0];
+        while (limits.running(processor, end_pc[0])) {
+            processor.advance<Model, Trace>();
+            if (limited) {
+                limits.check(processor);
+            }
+            if (Trace::enabled) {
+                HOST_PROFILE_SCOPE(HOST_OUTPUT);
+                cout << "\nCYCLE " << num_cycles << "\n";
+                processor.printRegFile();
+            }
+            num_cycles++;
+            if (sampling) {
+                sampler.tick(num_cycles);
+            }
+        }
+        return num_cycles;
+    }
+    auto live = [&](Processor &p) { return limits.running(p, end_pc[p.getCoreId()]); };
+    bool running = true;
+    while (running) {
+        running = false;
+        for (int k = 0; k < (int)arbiters.size(); k++) {
+            arbiters[k].select(live);
+        }
+        for (int c = 0; c < num_cores; c++) {
+            if (limits.running(cores[c], end_pc[c])) {
+                cores[c].advance<Model, Trace>();
+                if (limited) {
+                    limits.check(cores[c]);
+                }
+                running = true;
+            }
+        }
+        if (!running) {
+            break;
+        }
+        if (Trace::enabled) {
+            HOST_PROFILE_SCOPE(HOST_OUTPUT);
+            cout << "\nCYCLE " << num_cycles << "\n";
+            for (int c = 0; c < num_cores; c++) {
+                cout << "CORE " << c << "\n";
+                cores[c].printRegFile();
+            }
+        }
+        num_cycles++;
+        if (sampling) {
+            sampler.tick(num_cycles);
+        }
+    }
+    return num_cycles;
+}
+
+/* Pick the simulation loop for the timing model of the cores once, before the first cycle. */
+template <class Trace>
+uint64_t run(vector<Processor> &cores, vector<uint32_t> &end_pc, int num_threads, int quantum, IntervalSampler &sampler,
+             RunLimits &limits, vector<FetchArbiter> &arbiters)
+{
+    bool parallel = cores.size() > 1 && num_threads > 1;
+    switch (cores[0].getTimingModel()) {
+        case SINGLE_CYCLE:
+            return parallel ? parallel_main_loop<SINGLE_CYCLE>(cores, end_pc, num_threads, quantum, limits, arbiters) :
+                              main_loop<SINGLE_CYCLE, Trace>(cores, end_pc, sampler, limits, arbiters);
+        case FIVE_STAGE:
+            return parallel ? parallel_main_loop<FIVE_STAGE>(cores, end_pc, num_threads, quantum, limits, arbiters) :
+                              main_loop<FIVE_STAGE, Trace>(cores, end_pc, sampler, limits, arbiters);
+        case SCOREBOARD:
+            return parallel ? parallel_main_loop<SCOREBOARD>(cores, end_pc, num_threads, quantum, limits, arbiters) :
+                              main_loop<SCOREBOARD, Trace>(cores, end_pc, sampler, limits, arbiters);
+        default:
+            return parallel ? parallel_main_loop<CONFIGURABLE_PIPELINE>(cores, end_pc, num_threads, quantum, limits, arbiters) :
+                              main_loop<CONFIGURABLE_PIPELINE, Trace>(cores, end_pc, sampler, limits, arbiters);
+    }
+}
+
+/* Parse a cache geometry of the form <size>,<assoc>,<miss-penalty>[,<line-size>]; the name
+   and policies of the level are kept. */
+bool parse_cache_config(const char *arg, CacheConfig &config)
+{
+    CacheConfig c = config;
+    int n = sscanf(arg, "%d,%d,%d,%d", &c.size, &c.assoc, &c.missPenalty, &c.lineSize);
+    if (n != 3 && n != 4) {
+        cout << "Invalid cache configuration: " << arg << "\n";
+        return false;
+    }
+    config = c;
+    return true;
+}
+
+/* Parse a write policy of the form <wb|wt>[,<wa|nwa>]. */
+bool parse_write_policy(const char *arg, WritePolicy &policy)
+{
+    string spec(arg);
+    string write = spec.substr(0, spec.find(','));
+    string alloc = spec.find(',') == string::npos ? "" : spec.substr(spec.find(',')+1);
+    if ((write != "wb" && write != "wt") || (alloc != "" && alloc != "wa" && alloc != "nwa")) {
+        cout << "Invalid write policy: " << spec << "\n";
+        return false;
+    }
+    policy.writeBack = write == "wb";
+    if (alloc != "") {
+        policy.writeAllocate = alloc == "wa";
+    }
+    return true;
+}
+
+/* Parse an inclusion policy: inclusive, non-inclusive or exclusive. */
+bool parse_inclusion_policy(const char *arg, InclusionPolicy &inclusion)
+{
+    string policy(arg);
+    if (policy != "inclusive" && policy != "non-inclusive" && policy != "exclusive") {
+        cout << "Invalid inclusion policy: " << policy << "\n";
+        return false;
+    }
+    inclusion = policy == "inclusive" ? INCLUSIVE : policy == "exclusive" ? EXCLUSIVE : NON_INCLUSIVE;
+    return true;
+}
+
+/* Parse DRAM timing of the form <banks>,<row-size>,<tRCD>,<tCAS>,<tRP>,<burst>[,<open|closed>[,<queue>]]. */
+bool parse_dram_config(const char *arg, DramConfig &config)
+{
+    DramConfig d = config;
+    char page[16] = "";
+    int n = sscanf(arg, "%d,%d,%d,%d,%d,%d,%15[a-z],%d", &d.banks, &d.rowSize, &d.tRCD, &d.tCAS, &d.tRP, &d.burst, page, &d.queueSize);
+    if (n < 6 || (n > 6 && strcmp(page, "open") && strcmp(page, "closed")) || d.banks <= 0 || d.rowSize <= 0 ||
+        (d.rowSize & (d.rowSize-1)) || d.tRCD < 0 || d.tCAS <= 0 || d.tRP < 0 || d.burst <= 0 || d.queueSize <= 0) {
+        cout << "Invalid DRAM configuration: " << arg << "\n";
+        return false;
+    }
+    if (n > 6) {
+        d.openPage = !strcmp(page, "open");
+    }
+    config = d;
+    return true;
+}
+
+/* Parse a TLB of the form <entries>,<assoc>, and <latency> for the L2 TLB, which may have no
+   entries. Entries and associativity are powers of two. */
+bool parse_tlb_config(const char *arg, TlbConfig &config, bool l2)
+{
+    TlbConfig t = config;
+    int n = sscanf(arg, "%d,%d,%d", &t.entries, &t.assoc, &t.latency);
+    bool pow2 = t.assoc > 0 && !(t.assoc & (t.assoc-1)) && !(t.entries & (t.entries-1)) && t.entries >= (l2 ? 0 : t.assoc);
+    if (n != (l2 ? 3 : 2) || !pow2 || t.latency < 0) {
+        cout << "Invalid TLB configuration: " << arg << "\n";
+        return false;
+    }
+    config = t;
+    return true;
+}
+
+/* Parse a shared level of the form <name>,<size>,<assoc>,<miss-penalty>[,<line-size>]. */
+bool parse_cache_level(const char *arg, CacheConfig &config)
+{
+    string spec(arg);
+    if (spec.find(',') == string::npos || spec.find(',') == 0) {
+        cout << "Invalid cache level: " << spec << "\n";
+        return false;
+    }
+    config.name = spec.substr(0, spec.find(','));
+    return parse_cache_config(spec.c_str() + spec.find(',') + 1, config);
+}
+
+/* Read a hierarchy from a file, one level per line:
+     <name> <size> <assoc> <line-size> <miss-penalty> [key=value ...]
+   with keys inclusion=inclusive|non-inclusive|exclusive, repl=<policy>, write=<wb|wt>[,<wa|nwa>],
+   write-buffer=<entries>, writeback-buffer=<entries> and fill-width=<bytes>. Levels named l1i
+   and l1d configure the private L1s; all other levels are shared and listed nearest first. A line
+     dram <banks>,<row-size>,<tRCD>,<tCAS>,<tRP>,<burst>[,<open|closed>[,<queue>]]
+   enables the DRAM model behind the last level. # starts a comment. */
+bool parse_cache_file(const char *path, HierarchyConfig &hierarchy)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        cout << "Failed to open cache configuration: " << path << "\n";
+        return false;
+    }
+    HierarchyConfig h;
+    h.levels.clear();
+    char buf[512];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(buf, sizeof(buf), file)) {
+        lineno++;
+        string text(buf);
+        text = text.substr(0, text.find('#'));
+        vector<string> fields;
+        for (char *tok = strtok(&text[0], " \t\r\n"); tok; tok = strtok(nullptr, " \t\r\n")) {
+            fields.push_back(tok);
+        }
+        if (fields.empty()) {
+            continue;
+        }
+        if (fields[0] == "dram") {
+            ok = fields.size() == 2 && parse_dram_config(fields[1].c_str(), h.dram);
+            continue;
+        }
+        CacheConfig c = h.l1d;
+        c.name = fields[0];
+        ok = fields.size() >= 5 &&
+             sscanf((fields[1] + " " + fields[2] + " " + fields[3] + " " + fields[4]).c_str(), "%d %d %d %d",
+                    &c.size, &c.assoc, &c.lineSize, &c.missPenalty) == 4;
+        for (int f = 5; ok && f < (int)fields.size(); f++) {
+            string key = fields[f].substr(0, fields[f].find('='));
+            string value = fields[f].find('=') == string::npos ? "" : fields[f].substr(fields[f].find('=')+1);
+            if (key == "inclusion") {
+                ok = parse_inclusion_policy(value.c_str(), c.inclusion);
+            } else if (key == "repl") {
+                c.repl = value;
+            } else if (key == "write") {
+                ok = parse_write_policy(value.c_str(), c.write);
+            } else if (key == "write-buffer") {
+                c.write.writeBufferSize = max(1, atoi(value.c_str()));
+            } else if (key == "writeback-buffer") {
+                c.write.writebackBufferSize = max(0, atoi(value.c_str()));
+            } else if (key == "fill-width") {
+                c.fillWidth = max(0, atoi(value.c_str()));
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        if (c.name == "l1i" || c.name == "l1d") {
+            c.name = c.name == "l1i" ? "L1I" : "L1D";
+            (c.name == "L1I" ? h.l1i : h.l1d) = c;
+        } else {
+            h.levels.push_back(c);
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        cout << "Invalid cache configuration at " << path << ":" << lineno << "\n";
+        return false;
+    }
+    hierarchy = h;
+    return true;
+}
+
+/* Check that every level has a usable geometry and that line sizes do not shrink going down.
+   An exclusive level swaps whole lines with the levels above, so their line sizes must match. */
+bool check_cache_config(const CacheConfig &c, int upperLineSize, int upperMinLineSize)
+{
+    bool pow2 = c.size > 0 && c.assoc > 0 && c.lineSize > 0 &&
+                !(c.size & (c.size-1)) && !(c.assoc & (c.assoc-1)) && !(c.lineSize & (c.lineSize-1));
+    if (!pow2 || c.lineSize < 4 || c.lineSize > MAX_LINE_SIZE || c.missPenalty <= 0 || c.size < c.assoc*c.lineSize) {
+        cout << "Invalid cache configuration for " << c.name << ": " << c.size << "," << c.assoc << ","
+             << c.missPenalty << "," << c.lineSize << "\n";
+        return false;
+    }
+    if (c.lineSize < upperLineSize) {
+        cout << "Line size of " << c.name << " is smaller than the level above it\n";
+        return false;
+    }
+    if (c.inclusion == EXCLUSIVE && upperLineSize && (c.lineSize != upperLineSize || c.lineSize != upperMinLineSize)) {
+        cout << "Exclusive level " << c.name << " needs the line size of the levels above it\n";
+        return false;
+    }
+    ReplacementPolicy *p = makeReplacementPolicy(c.repl, c.size/(c.lineSize*c.assoc), c.assoc);
+    if (!p) {
+        cout << "Invalid replacement policy for " << c.name << ": " << c.repl << "\n";
+        return false;
+    }
+    delete p;
+    return true;
+}
+
 void print_help()
 {
     cout << "Required Options.\n" 
@@ -79,7 +500,75 @@ void print_help()
             "-O2                                  Optimization Level 2 (custom optimization TBD; includes O1)\n"
             "-O3                                  Optimization Level 3 (custom optimization TBD; includes O2)\n"
             "-O4                                  Optimization Level 4 (custom optimization TBD; includes O3)\n"
-            "                                     Defaults to -O0\n";
+            "                                     Defaults to -O0\n"
+            "--cores <n>                          Number of cores sharing one benchmark image (core id in $k0)\n"
+            "                                     Passing --bmk several times runs one image per core instead\n"
+            "--contexts <n>                       Hardware contexts per core sharing its fetch slot and caches (thread\n"
+            "                                     id in $k0); with several --bmk, one image per context\n"
+            "--fetch-policy <policy>              Context fetching each cycle: round-robin (default), switch-on-miss\n"
+            "                                     (until an L1I or L1D miss) or icount (fewest instructions in flight)\n"
+            "--threads <n>                        Host threads used to simulate the cores (per-cycle dump disabled)\n"
+            "--quantum <cycles>                   Cycles simulated between host thread synchronizations (default 1000)\n"
+            "--stats                              Print cache statistics at the end of the run\n"
+            "--no-trace                           Print the register file only at the end instead of every cycle\n"
+            "--pipeline <if>,<id>,<ex>,<mem>      Use the configurable pipeline with these stages per phase; the\n"
+            "                                     reported time uses the cycle time of the resulting design\n"
+            "--early-branch                       Resolve branches and jumps in ID (taken branches cost one bubble)\n"
+            "--scoreboard                         Issue in order past pending results through a scoreboard, completing\n"
+            "                                     loads and multi-cycle operations out of order\n"
+            "--fetch-queue <entries>[,<width>]    Decouple fetch from decode with an instruction buffer filled with\n"
+            "                                     up to <width> words per cycle (default 0: off, width 1)\n"
+            "--loop-buffer <instructions>         Replay short backward-branch loops without the L1I (default 0: off;\n"
+            "                                     enables a 4 entry fetch queue if none is given)\n"
+            "--fusion                             Fuse lui+ori/addiu, slt+beq/bne and addiu/lui+load pairs in decode\n"
+            "                                     (five-stage model; enables a 4 entry, 2-wide fetch queue if none is given)\n"
+            "--value-predict <entries>[,<conf>]   Predict load values with a stride predictor once a stride repeated\n"
+            "                                     <conf> (1-3, default 2) times; five-stage model (default 0: off)\n"
+            "--mul-latency <cycles>               Pipelined multiplier latency until mfhi/mflo (default 4)\n"
+            "--div-latency <cycles>               Iterative divider latency, one divide at a time (default 32)\n"
+            "--mem-trace <path>                   Record the data accesses into a compressed trace for stackdist\n"
+            "                                     (<path>.<core> per core in a multicore run)\n"
+            "--interval <n>[c|i]                  Sample IPC, miss rates, stalls and mispredicts every <n> cycles\n"
+            "                                     (c, default) or retired instructions (i); needs --threads 1\n"
+            "--interval-out <path>                File for the samples, CSV or JSON lines if it ends in .json/.jsonl\n"
+            "                                     (default intervals.csv)\n"
+            "--host-profile                       Print the host time spent per simulator component (build with\n"
+            "                                     make HOST_PROFILE=1)\n"
+            "--cache-config <file>                Read the cache hierarchy from a file (see README)\n"
+            "--cache-level <name>,<size>,<assoc>,<penalty>[,<line>]\n"
+            "                                     Append a shared level below the existing ones\n"
+            "--dram <banks>,<row-size>,<tRCD>,<tCAS>,<tRP>,<burst>[,<open|closed>[,<queue>]]\n"
+            "                                     Time memory with a banked DRAM model (e.g. 8,2048,14,14,14,4)\n"
+            "                                     instead of the last level's miss penalty\n"
+            "--l1i <size>,<assoc>,<penalty>[,<line>]\n"
+            "                                     L1 instruction cache geometry (default 32768,8,12,64)\n"
+            "--l1d <size>,<assoc>,<penalty>[,<line>]\n"
+            "                                     L1 data cache geometry (default 32768,8,12,64)\n"
+            "--l2 <size>,<assoc>,<penalty>[,<line>]\n"
+            "                                     First shared level geometry (default 262144,8,59,64)\n"
+            "--l1-policy <wb|wt>[,<wa|nwa>]       L1D write policy: write-back/write-through, (no-)write-allocate\n"
+            "--l2-policy <wb|wt>[,<wa|nwa>]       First shared level write policy (defaults to wb,wa everywhere)\n"
+            "--l1-repl <policy>                   L1 replacement policy: lru, plru, srrip, brrip, random\n"
+            "--l2-repl <policy>                   L2 replacement policy (defaults to lru for both levels)\n"
+            "--l2-inclusion <policy>              inclusive (default), non-inclusive, or exclusive: the L2 holds\n"
+            "                                     only lines evicted from the L1s (a victim cache)\n"
+            "--write-buffer <entries>             Coalescing write buffer entries per level (default 1)\n"
+            "--writeback-buffer <entries>         Writeback buffer entries per level, 0 writes back\n"
+            "                                     before the refill (default 0)\n"
+            "--critical-word-first <bytes>        Refill lines <bytes> per cycle starting with the requested word,\n"
+            "                                     which ends the miss early; later words wait for their beat\n"
+            "--tag-only                           Keep only tags and state in the caches and read and write data in\n"
+            "                                     memory directly (same timing, less host memory traffic)\n"
+            "--vm                                 Translate addresses through TLBs and page tables built by the loader\n"
+            "--page-size <bytes>                  Page size of the virtual memory (default 4096; implies --vm)\n"
+            "--itlb <entries>,<assoc>             L1 instruction TLB per core (default 64,4)\n"
+            "--dtlb <entries>,<assoc>             L1 data TLB per core (default 64,4)\n"
+            "--l2tlb <entries>,<assoc>,<latency>  Shared L2 TLB, looked up in <latency> cycles after an L1 TLB miss\n"
+            "                                     (default 1024,8,8; 0 entries: walk on every L1 TLB miss)\n"
+            "--roi                                Execute functionally up to the ROI begin marker (addiu $0,$0,1),\n"
+            "                                     then simulate in detail until the end marker (addiu $0,$0,2)\n"
+            "--max-insts <n>                      Stop each core after it retired <n> instructions in the measured region\n"
+            "--max-cycles <n>                     Stop each core after <n> cycles in the measured region\n";
 }
 
 int main(int argc, char *argv[]) {
@@ -91,14 +580,87 @@ int main(int argc, char *argv[]) {
       {"opt2", optional_argument, 0, '2'},
       {"opt3", optional_argument, 0, '3'},
       {"opt4", optional_argument, 0, '4'},
-      {"help", no_argument, 0, 'h'}
+      {"cores", required_argument, 0, 'c'},
+      {"threads", required_argument, 0, 't'},
+      {"contexts", required_argument, 0, 'k'},
+      {"fetch-policy", required_argument, 0, 'j'},
+      {"quantum", required_argument, 0, 'q'},
+      {"stats", no_argument, 0, 's'},
+      {"no-trace", no_argument, 0, 'n'},
+      {"l1i", required_argument, 0, 'i'},
+      {"l1d", required_argument, 0, 'd'},
+      {"l2", required_argument, 0, 'L'},
+      {"l1-policy", required_argument, 0, 'w'},
+      {"l2-policy", required_argument, 0, 'W'},
+      {"write-buffer", required_argument, 0, 'B'},
+      {"l1-repl", required_argument, 0, 'r'},
+      {"l2-repl", required_argument, 0, 'R'},
+      {"l2-inclusion", required_argument, 0, 'x'},
+      {"writeback-buffer", required_argument, 0, 'V'},
+      {"critical-word-first", required_argument, 0, 'F'},
+      {"cache-config", required_argument, 0, 'C'},
+      {"cache-level", required_argument, 0, 'A'},
+      {"dram", required_argument, 0, 'D'},
+      {"mul-latency", required_argument, 0, 'm'},
+      {"early-branch", no_argument, 0, 'e'},
+      {"scoreboard", no_argument, 0, 'S'},
+      {"pipeline", required_argument, 0, 'P'},
+      {"fetch-queue", required_argument, 0, 'f'},
+      {"loop-buffer", required_argument, 0, 'l'},
+      {"value-predict", required_argument, 0, 'p'},
+      {"fusion", no_argument, 0, 'u'},
+      {"div-latency", required_argument, 0, 'v'},
+      {"mem-trace", required_argument, 0, 'M'},
+      {"interval", required_argument, 0, 'I'},
+      {"interval-out", required_argument, 0, 'o'},
+      {"host-profile", no_argument, 0, 'H'},
+      {"tag-only", no_argument, 0, 'T'},
+      {"vm", no_argument, 0, 'z'},
+      {"page-size", required_argument, 0, 'Z'},
+      {"itlb", required_argument, 0, 'a'},
+      {"dtlb", required_argument, 0, 'E'},
+      {"l2tlb", required_argument, 0, 'J'},
+      {"roi", no_argument, 0, 'g'},
+      {"max-insts", required_argument, 0, 'N'},
+      {"max-cycles", required_argument, 0, 'Y'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}
     };
     int option_index = 0;
     bool initialized = false;
 
-    Memory memory;
-    Processor processor(&memory); 
-    uint32_t end_pc = 0;
+    vector<char *> bmks;
+    int num_cores = 1;
+    int num_contexts = 1;
+    FetchPolicy fetch_policy = FETCH_ROUND_ROBIN;
+    int num_threads = 1;
+    int quantum = 1000;
+    bool print_stats = false;
+    bool trace = true;
+    HierarchyConfig hierarchy;
+    int write_buffer = 0;
+    int writeback_buffer = -1;
+    int fill_width = 0;
+
+    PipelineConfig pipeline = {1, 1, 1, 1};
+    bool custom_pipeline = false;
+    bool early_branch = false;
+    bool scoreboard = false;
+    int fetch_queue = 0;
+    int fetch_width = 1;
+    bool fusion = false;
+    int loop_buffer = 0;
+    int lvp_entries = 0;
+    int lvp_confidence = 2;
+    int mul_latency = 4;
+    int div_latency = 32;
+    const char *mem_trace = nullptr;
+    uint64_t interval = 0;
+    bool interval_insts = false;
+    const char *interval_out = nullptr;
+    bool host_profile = false;
+    bool tag_only = false;
+    RunLimits limits = {false, 0, 0};
 
     int optLevel = 0;
 
@@ -117,7 +679,7 @@ int main(int argc, char *argv[]) {
               print_help();
               exit(0);
           case 'b':
-              end_pc = load(optarg, memory);
+              bmks.push_back(optarg);
               break;
           case 'O':
               break;
@@ -127,20 +689,376 @@ int main(int argc, char *argv[]) {
           case '3':
           case '4':
               optLevel = c-'0';
-              processor.initialize(optLevel);
               initialized = 1;
               break;
+          case 'c':
+              num_cores = max(1, atoi(optarg));
+              break;
+          case 'k':
+              num_contexts = max(1, atoi(optarg));
+              break;
+          case 'j':
+              if (strcmp(optarg, "round-robin") && strcmp(optarg, "switch-on-miss") && strcmp(optarg, "icount")) {
+                  cout << "Invalid fetch policy: " << optarg << "\n";
+                  exit(1);
+              }
+              fetch_policy = !strcmp(optarg, "icount") ? FETCH_ICOUNT :
+                             !strcmp(optarg, "switch-on-miss") ? FETCH_SWITCH_ON_MISS : FETCH_ROUND_ROBIN;
+              break;
+          case 't':
+              num_threads = max(1, atoi(optarg));
+              break;
+          case 'q':
+              quantum = max(1, atoi(optarg));
+              break;
+          case 's':
+              print_stats = true;
+              break;
+          case 'n':
+              trace = false;
+              break;
+          case 'C':
+              if (!parse_cache_file(optarg, hierarchy)) {
+                  exit(1);
+              }
+              break;
+          case 'P':
+              if (sscanf(optarg, "%d,%d,%d,%d", &pipeline.fetch, &pipeline.decode, &pipeline.execute, &pipeline.memory) != 4 ||
+                  pipeline.fetch < 1 || pipeline.decode < 1 || pipeline.execute < 1 || pipeline.memory < 1) {
+                  cout << "Invalid pipeline configuration: " << optarg << "\n";
+                  exit(1);
+              }
+              custom_pipeline = true;
+              break;
+          case 'e':
+              early_branch = true;
+              break;
+          case 'S':
+              scoreboard = true;
+              break;
+          case 'f':
+              if (sscanf(optarg, "%d,%d", &fetch_queue, &fetch_width) < 1 || fetch_queue < 0 || fetch_width < 1) {
+                  cout << "Invalid fetch queue configuration: " << optarg << "\n";
+                  exit(1);
+              }
+              break;
+          case 'u':
+              fusion = true;
+              break;
+          case 'M':
+              mem_trace = optarg;
+              break;
+          case 'I': {
+              char unit = 'c';
+              if (sscanf(optarg, "%llu%c", (unsigned long long *)&interval, &unit) < 1 || !interval || (unit != 'c' && unit != 'i')) {
+                  cout << "Invalid interval: " << optarg << "\n";
+                  exit(1);
+              }
+              interval_insts = unit == 'i';
+              break;
+          }
+          case 'o':
+              interval_out = optarg;
+              break;
+          case 'H':
+              host_profile = true;
+              break;
+          case 'T':
+              tag_only = true;
+              break;
+          case 'z':
+              hierarchy.vm.enabled = true;
+              break;
+          case 'Z':
+              hierarchy.vm.pageSize = atoi(optarg);
+              hierarchy.vm.enabled = true;
+              break;
+          case 'a':
+          case 'E':
+          case 'J': {
+              TlbConfig &tlb = c == 'a' ? hierarchy.vm.itlb : c == 'E' ? hierarchy.vm.dtlb : hierarchy.vm.l2tlb;
+              if (!parse_tlb_config(optarg, tlb, c == 'J')) {
+                  exit(1);
+              }
+              break;
+          }
+          case 'g':
+              limits.roi = true;
+              break;
+          case 'N':
+              limits.maxInsts = strtoull(optarg, nullptr, 10);
+              break;
+          case 'Y':
+              limits.maxCycles = strtoull(optarg, nullptr, 10);
+              break;
+          case 'l':
+              loop_buffer = max(0, atoi(optarg));
+              break;
+          case 'p':
+              if (sscanf(optarg, "%d,%d", &lvp_entries, &lvp_confidence) < 1 || lvp_entries < 0) {
+                  cout << "Invalid value predictor configuration: " << optarg << "\n";
+                  exit(1);
+              }
+              break;
+          case 'm':
+              mul_latency = max(1, atoi(optarg));
+              break;
+          case 'v':
+              div_latency = max(1, atoi(optarg));
+              break;
+          case 'D':
+              if (!parse_dram_config(optarg, hierarchy.dram)) {
+                  exit(1);
+              }
+              break;
+          case 'A':
+              hierarchy.levels.push_back(hierarchy.levels.empty() ? hierarchy.l1d : hierarchy.levels.back());
+              if (!parse_cache_level(optarg, hierarchy.levels.back())) {
+                  exit(1);
+              }
+              break;
+          case 'i':
+          case 'd':
+          case 'L':
+          case 'w':
+          case 'W':
+          case 'r':
+          case 'R':
+          case 'x': {
+              // L2 options apply to the first shared level
+              bool upper = c == 'i' || c == 'd' || c == 'w' || c == 'r';
+              if (!upper && hierarchy.levels.empty()) {
+                  cout << "No shared cache level to configure\n";
+                  exit(1);
+              }
+              CacheConfig &level = c == 'i' ? hierarchy.l1i : upper ? hierarchy.l1d : hierarchy.levels[0];
+              if ((c == 'i' || c == 'd' || c == 'L') && !parse_cache_config(optarg, level)) {
+                  exit(1);
+              }
+              if ((c == 'w' || c == 'W') && !parse_write_policy(optarg, level.write)) {
+                  exit(1);
+              }
+              if (c == 'x' && !parse_inclusion_policy(optarg, level.inclusion)) {
+                  exit(1);
+              }
+              if (c == 'r' || c == 'R') {
+                  level.repl = optarg;
+                  if (c == 'r') {
+                      hierarchy.l1i.repl = optarg;
+                  }
+              }
+              break;
+          }
+          case 'B':
+              write_buffer = max(1, atoi(optarg));
+              break;
+          case 'V':
+              writeback_buffer = max(0, atoi(optarg));
+              break;
+          case 'F':
+              fill_width = max(0, atoi(optarg));
+              break;
       }
     }
 
+    // One image per hardware context, or a single image shared by all of them
+    if (bmks.size() > 1) {
+        if (bmks.size() % num_contexts) {
+            cout << "The number of images is not a multiple of --contexts\n";
+            exit(1);
+        }
+        num_cores = bmks.size() / num_contexts;
+    }
+    int num_hw_threads = num_cores * num_contexts;
+    num_threads = min(num_threads, num_cores);
+    hierarchy.tagOnly = tag_only;
+
+    // Buffer sizes and the refill width given on the command line apply to every level
+    vector<CacheConfig *> configs = {&hierarchy.l1i, &hierarchy.l1d};
+    for (int k = 0; k < (int)hierarchy.levels.size(); k++) {
+        configs.push_back(&hierarchy.levels[k]);
+    }
+    for (int k = 0; k < (int)configs.size(); k++) {
+        if (write_buffer) {
+            configs[k]->write.writeBufferSize = write_buffer;
+        }
+        if (writeback_buffer >= 0) {
+            configs[k]->write.writebackBufferSize = writeback_buffer;
+        }
+        if (fill_width) {
+            configs[k]->fillWidth = fill_width;
+        }
+        int upperLineSize = k < 2 ? 0 : configs[k == 2 ? 1 : k-1]->lineSize;
+        int upperMinLineSize = upperLineSize;
+        if (k == 2) {
+            upperLineSize = max(upperLineSize, hierarchy.l1i.lineSize);
+            upperMinLineSize = min(upperMinLineSize, hierarchy.l1i.lineSize);
+        }
+        if (!check_cache_config(*configs[k], upperLineSize, upperMinLineSize)) {
+            exit(1);
+        }
+    }
+
+    if (hierarchy.dram.banks && hierarchy.dram.rowSize < configs.back()->lineSize) {
+        cout << "DRAM rows are smaller than a line of " << configs.back()->name << "\n";
+        exit(1);
+    }
+
+    int page_size = hierarchy.vm.pageSize;
+    if (hierarchy.vm.enabled && (page_size < 1024 || page_size > 4194304 || (page_size & (page_size-1)))) {
+        cout << "Invalid page size: " << page_size << "\n";
+        exit(1);
+    }
+
+    if (scoreboard && custom_pipeline) {
+        cout << "--scoreboard and --pipeline select different timing models\n";
+        exit(1);
+    }
+
+    if (fusion && !fetch_queue) {
+        fetch_queue = 4;
+        fetch_width = 2;
+    }
+    if (loop_buffer && !fetch_queue) {
+        fetch_queue = 4;
+    }
+
+    Memory memory(num_cores, hierarchy, num_contexts);
+    vector<Processor> cores;
+    vector<uint32_t> end_pc(num_hw_threads, 0);
+    for (int c = 0; c < num_hw_threads; c++) {
+        cores.push_back(Processor(&memory, c));
+        cores[c].initialize(optLevel);
+        cores[c].setUnitLatencies(mul_latency, div_latency);
+        cores[c].setEarlyBranch(early_branch);
+        cores[c].setScoreboard(scoreboard);
+        cores[c].setFrontEnd(fetch_queue, fetch_width, loop_buffer);
+        cores[c].setFusion(fusion);
+        cores[c].setValuePredictor(lvp_entries, lvp_confidence);
+        if (custom_pipeline) {
+            cores[c].setPipeline(pipeline);
+        }
+        if (bmks.size() > 1) {
+            memory.setCoreBase(c, c * (memory.size() / num_hw_threads));
+        }
+        // the loader maps the pages of the thread before writing its image through them
+        if (memory.virtualMemory()) {
+            memory.mapPages(c);
+        }
+        if (bmks.size() > 1) {
+            end_pc[c] = load(bmks[c], memory, c);
+        } else if (bmks.size() == 1) {
+            end_pc[c] = c ? end_pc[0] : load(bmks[0], memory);
+        }
+    }
+    limits.stopped.assign(num_hw_threads, RUNNING);
+
+    // The contexts of core k are hardware threads k*num_contexts to (k+1)*num_contexts-1
+    vector<FetchArbiter> arbiters;
+    for (int k = 0; num_contexts > 1 && k < num_cores; k++) {
+        vector<Processor *> contexts;
+        for (int c = k * num_contexts; c < (k + 1) * num_contexts; c++) {
+            contexts.push_back(&cores[c]);
+        }
+        arbiters.push_back(FetchArbiter(fetch_policy, contexts));
+    }
+
+    // Up to the region of interest the cores only execute; the caches start cold there
+    if (limits.roi) {
+        for (int c = 0; c < num_hw_threads; c++) {
+            cores[c].setROI(true);
+        }
+        vector<bool> entered = fast_forward(cores, end_pc);
+        for (int c = 0; c < num_hw_threads; c++) {
+            if (entered[c]) {
+                cout << "Core " << c << " entered the region of interest after " << cores[c].getStats().retired
+                     << " instructions\n";
+            } else {
+                cout << "Core " << c << " found no region of interest\n";
+            }
+            cores[c].startDetailed();
+        }
+        memory.resetStats();
+    }
+
+    // The loader's writes are not part of the trace: capture starts with the first cycle
+    vector<MemoryTraceWriter *> traces;
+    for (int c = 0; mem_trace && c < num_hw_threads; c++) {
+        string path = num_hw_threads > 1 ? string(mem_trace) + "." + to_string(c) : string(mem_trace);
+        traces.push_back(new MemoryTraceWriter());
+        if (!traces[c]->open(path.c_str())) {
+            cout << "Failed to open memory trace: " << path << "\n";
+            exit(1);
+        }
+        cores[c].setMemoryTrace(traces[c]);
+    }
+
+    IntervalSampler sampler;
+    if (interval) {
+        if (num_hw_threads > 1 && num_threads > 1) {
+            cout << "Interval statistics need the cores simulated on one thread\n";
+            exit(1);
+        }
+        const char *path = interval_out ? interval_out : "intervals.csv";
+        if (!sampler.open(path, interval, interval_insts, cores, memory)) {
+            cout << "Failed to open interval output: " << path << "\n";
+            exit(1);
+        }
+    }
+
     memory.setOptLevel(optLevel);
-    uint64_t num_cycles = 0;
-    while (processor.getPC() <= end_pc) {
-        processor.advance();
-        cout << "\nCYCLE " << num_cycles << "\n";
-        processor.printRegFile();
-        num_cycles++;
+    host_profile_start();
+    uint64_t num_cycles = trace ? run<CycleTrace>(cores, end_pc, num_threads, quantum, sampler, limits, arbiters) :
+                                  run<NoTrace>(cores, end_pc, num_threads, quantum, sampler, limits, arbiters);
+    sampler.finish(num_cycles);
+    for (int c = 0; c < (int)traces.size(); c++) {
+        traces[c]->close();
+        cores[c].setMemoryTrace(nullptr);
     }
 
-    cout << "\nCompleted execution in " << (double)num_cycles*(optLevel ? 1 : 125)*0.5 << " nanoseconds.\n";
+    if (!trace || (num_hw_threads > 1 && num_threads > 1)) {
+        HOST_PROFILE_SCOPE(HOST_OUTPUT);
+        for (int c = 0; c < num_hw_threads; c++) {
+            cout << "\nCORE " << c << "\n";
+            cores[c].printRegFile();
+        }
+    }
+
+    for (int c = 0; c < num_hw_threads; c++) {
+        const char *reasons[] = {"", "at the end of the region of interest", "at the instruction limit", "at the cycle limit"};
+        if (limits.stopped[c]) {
+            cout << "\nCore " << c << " stopped " << reasons[limits.stopped[c]] << "\n";
+        }
+    }
+
+    if (print_stats && optLevel) {
+        memory.printStats();
+        for (int c = 0; c < num_hw_threads; c++) {
+            cores[c].printStats();
+            if (c < (int)traces.size()) {
+                cout << "Memory trace accesses: " << traces[c]->count() << "\n";
+            }
+        }
+    }
+
+    // Throughput of each core over its contexts: instructions of all of them per cycle of the core
+    for (int k = 0; num_contexts > 1 && k < num_cores; k++) {
+        uint64_t retired = 0, cycles = 0;
+        string ipcs;
+        for (int c = k * num_contexts; c < (k + 1) * num_contexts; c++) {
+            const CoreStats &s = cores[c].getStats();
+            retired += s.retired;
+            cycles = max(cycles, s.cycles);
+            ipcs += (ipcs.empty() ? "" : " ") + to_string(s.cycles ? (double)s.retired / s.cycles : 0.0);
+        }
+        cout << "\nCore " << k << " contexts retired: " << retired << " cycles: " << cycles << " IPC: "
+             << (cycles ? (double)retired / cycles : 0.0) << " (per context: " << ipcs << ")\n";
+    }
+    for (int c = 0; c < (int)traces.size(); c++) {
+        delete traces[c];
+    }
+    if (host_profile && !host_profile_print()) {
+        cout << "\nHost profiling is not compiled in, rebuild with make clean; make HOST_PROFILE=1\n";
+    }
+    cout << "\nCompleted execution in " << (double)num_cycles*(optLevel ? 1 : 125)*cores[0].getCycleTime() << " nanoseconds.\n";
 }
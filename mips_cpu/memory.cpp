@@ -2,7 +2,9 @@
 #include <cstdint>
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
 #include "memory.h"
+#include "hostprof.h"
 
 #ifdef ENABLE_DEBUG
 #define DEBUG(x) x
@@ -14,6 +16,7 @@ using namespace std;
 
 // Check if hit in the cache
 bool Cache::isHit(uint32_t address, uint32_t &loc) {
+    HOST_PROFILE_SCOPE(HOST_CACHE_LOOKUP);
     int idx = getIndex(address);
     int tag = getTag(address);
 
@@ -27,121 +30,829 @@ bool Cache::isHit(uint32_t address, uint32_t &loc) {
     return false;
 }
 
-// Update replacement bits after access
+// Update replacement state after access
 void Cache::updateReplacementBits(int idx, int way) {
-    uint8_t curRepl = line[idx*assoc+way].replBits;
+    repl->touch(idx, way);
+}
+
+// Location of the valid line holding this address, -1 if absent
+int Cache::find(uint32_t address) {
+    int idx = getIndex(address);
+    int tag = getTag(address);
+
     for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].replBits > curRepl)
-            line[idx*assoc+w].replBits--;
+        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
+            return idx*assoc+w;
+        }
     }
-    line[idx*assoc+way].replBits = assoc-1;
+    return -1;
 }
 
 // Read a word from this cache
-bool Cache::read(uint32_t address, uint32_t &read_data) {
+bool Cache::read(uint32_t address, uint32_t &read_data, int port) {
     uint32_t loc = 0;
-    if (missCountdown) {
-        DEBUG(cout << name + " Cache (read miss) at address " << std::hex << address << std::dec << ": " << missCountdown << " cycles remaining to be serviced\n");
-        missCountdown--;
+    if (missCountdown[port]) {
+        DEBUG(cout << name + " Cache (read miss) at address " << std::hex << address << std::dec << ": " << missCountdown[port] << " cycles remaining to be serviced\n");
+        missCountdown[port]--;
         return false;
     }
     // Once miss penalty is completely paid, isHit should return true
     if (!isHit(address, loc)) {
-        missCountdown = missPenalty-1;
+        countMiss(address, port);
+        missCountdown[port] = missPenalty-1-earlyRestart;
+        return false;
+    }
+    // critical word first: the line is in but this word is still on its way
+    if (beatWords && *clock < wordArrival(loc, address)) {
+        stats.fillWaits++;
         return false;
     }
-    read_data = line[loc].data[getOffset(address)/4]; 
+    countHit(address, port);
+    read_data = store ? store[address/4] : data[loc*lineWords + getOffset(address)/4];
     DEBUG(cout << name + " Cache (read hit): " << read_data << "<-[" << std::hex << address << std::dec << "]\n");
     return true;
 }
 
 // Write a word to this cache
-bool Cache::write(uint32_t address, uint32_t write_data) {
+bool Cache::write(uint32_t address, uint32_t write_data, int port) {
     uint32_t loc = 0;
-    if (missCountdown) {
-        DEBUG(cout << name + " Cache (write miss) at address " << std::hex << address << std::dec << ": " << missCountdown << " cycles remaining to be serviced\n");
-        missCountdown--;
+    if (missCountdown[port]) {
+        DEBUG(cout << name + " Cache (write miss) at address " << std::hex << address << std::dec << ": " << missCountdown[port] << " cycles remaining to be serviced\n");
+        missCountdown[port]--;
         return false;
     }
     // Once miss penalty is completely paid, isHit should return true
     if (!isHit(address, loc)) {
-        missCountdown = missPenalty-1;
+        countMiss(address, port);
+        missCountdown[port] = missPenalty-1-earlyRestart;
+        return false;
+    }
+    // critical word first: the line is in but this word is still on its way
+    if (beatWords && *clock < wordArrival(loc, address)) {
+        stats.fillWaits++;
+        return false;
+    }
+    // write-through: the store also needs a write buffer entry to reach the next level
+    if (!policy.writeBack && !postWrite(address)) {
         return false;
     }
-    line[loc].data[getOffset(address)/4] = write_data;
-    line[loc].dirty = true; 
+    countHit(address, port);
+    (store ? store[address/4] : data[loc*lineWords + getOffset(address)/4]) = write_data;
+    if (policy.writeBack) {
+        line[loc].dirty = true; 
+    }
     DEBUG(cout << name + " Cache (write hit): [" << std::hex << address << std::dec << "]<-" << write_data << "\n");
     return true;
 }
 
-// Call this only if you know that a valid line with matching tag exists at that address 
-CacheLine Cache::readLine(uint32_t address) {
-    int idx = getIndex(address);
-    int tag = getTag(address);
+// Write a word into a present line without timing, returns false if the line is absent
+bool Cache::writeWord(uint32_t address, uint32_t write_data) {
+    int loc = find(address);
+    if (loc < 0) {
+        return false;
+    }
+    (store ? store[address/4] : data[loc*lineWords + getOffset(address)/4]) = write_data;
+    if (policy.writeBack) {
+        line[loc].dirty = true;
+    }
+    return true;
+}
 
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-            return line[idx*assoc+w];
-        }
+// Send a store to the next level through the write buffer, returns false if the buffer is full
+bool Cache::postWrite(uint32_t address) {
+    uint32_t lineAddr = getLineAddress(address);
+    if (!writeBuffer.canAccept(lineAddr)) {
+        DEBUG(cout << name + " Cache: write buffer full at address " << std::hex << address << std::dec << "\n");
+        stats.bufferStalls++;
+        return false;
     }
-    CacheLine c;
-    c.valid = false;
-    return c;
+    stats.writeThroughs++;
+    stats.coalesced += writeBuffer.find(lineAddr) >= 0;
+    stats.trafficBytes += 4*writeBuffer.push(lineAddr, 1ull << (getOffset(address)/4));
+    return true;
 }
 
-// Call this only if you know that a valid line with matching tag exists at that address 
-void Cache::writeBackLine(CacheLine evictedLine) {
-    int idx = getIndex(evictedLine.address);
-    int tag = getTag(evictedLine.address);
+// Send words of a line to the next level on behalf of an upper level
+void Cache::forwardWrite(uint32_t address, int numWords) {
+    uint32_t lineAddr = getLineAddress(address);
+    uint64_t wordMask = (numWords >= 64 ? ~0ull : (1ull << numWords)-1) << (getOffset(address)/4);
+    if (!writeBuffer.canAccept(lineAddr)) {
+        stats.bufferStalls++;
+        writeBuffer.pop();
+    }
+    stats.writeThroughs++;
+    stats.coalesced += writeBuffer.find(lineAddr) >= 0;
+    stats.trafficBytes += 4*writeBuffer.push(lineAddr, wordMask);
+}
 
-    for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-            for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-                line[idx*assoc+w].data[i] = evictedLine.data[i];
-            }
-            line[idx*assoc+w].dirty = true;
-        }
+// Account a dirty eviction from this level, returns the cycles the refill has to wait for it
+int Cache::queueWriteback(uint32_t address) {
+    stats.writebacks++;
+    stats.trafficBytes += lineSize;
+    // without a writeback buffer the victim is written to the next level before the refill
+    if (!writebackBuffer.enabled()) {
+        return missPenalty;
     }
+    int stall = 0;
+    if (writebackBuffer.full()) {
+        DEBUG(cout << name + " Cache: writeback buffer full at address " << std::hex << address << std::dec << "\n");
+        stats.bufferStalls++;
+        stall = writebackBuffer.cyclesToFree();
+        writebackBuffer.pop();
+    }
+    writebackBuffer.push(getLineAddress(address), lineWords >= 64 ? ~0ull : (1ull << lineWords)-1);
+    return stall;
+}
+
+// Write dirty words from an upper level into a present line, returns false if the line is absent
+bool Cache::writeBackLine(uint32_t address, const uint32_t *words, int numWords) {
+    int loc = find(address);
+    if (loc < 0) {
+        return false;
+    }
+    for (int i = 0; !store && i < numWords; i++) {
+        data[loc*lineWords + getOffset(address)/4 + i] = words[i];
+    }
+    if (policy.writeBack) {
+        line[loc].dirty = true;
+    }
+    return true;
 }
 
 // Replace a line at the set corresponding this address
-void Cache::replace(uint32_t address, CacheLine newLine, CacheLine &evictedLine) {
+void Cache::replace(uint32_t address, const uint32_t *newData, CacheLine &evictedLine, uint32_t *evictedData) {
+    HOST_PROFILE_SCOPE(HOST_CACHE_REPLACE);
     int idx = getIndex(address);
-    newLine.address = address;
+    CacheLine newLine;
+    newLine.address = getLineAddress(address);
     newLine.tag = getTag(address);
     newLine.valid = true;
+    newLine.dirty = false;
+    newLine.snooped = false;
+    newLine.burstStart = 0;
+    newLine.criticalWord = 0;
    
-    /* Return if replacement already completed. */ 
+    /* Return if replacement already completed, otherwise prefer an invalid way. */ 
+    int way = -1;
     for (int w=0; w<assoc; w++) {
         if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == newLine.tag) {
             return;
         }
+        if (line[idx*assoc+w].tag == newLine.tag) {
+            line[idx*assoc+w].snooped = false;
+        }
+        if (way < 0 && !line[idx*assoc+w].valid) {
+            way = w;
+        }
     }
     /* Replace. */ 
-    for (int w=0; w<assoc; w++) {
-        if (!line[idx*assoc+w].valid || line[idx*assoc+w].replBits == 0) {
-            DEBUG(cout << name + " Cache: replacing line at idx:" << idx << " way:" << w << " due to conflicting address:" << std::hex << address << std::dec << "\n");
-            evictedLine = line[idx*assoc+w];
-            line[idx*assoc+w] = newLine;
-            return;
+    if (way < 0) {
+        way = repl->victim(idx);
+    }
+    int loc = idx*assoc+way;
+    DEBUG(cout << name + " Cache: replacing line at idx:" << idx << " way:" << way << " due to conflicting address:" << std::hex << address << std::dec << "\n");
+    evictedLine = line[loc];
+    line[loc] = newLine;
+    if (!store) {
+        if (evictedLine.valid) {
+            std::copy(&data[loc*lineWords], &data[loc*lineWords] + lineWords, evictedData);
         }
+        std::copy(newData, newData + lineWords, &data[loc*lineWords]);
+    }
+    repl->insert(idx, way);
+}
+
+// Invalidate a line, returns true and the line with its words if it was dirty 
+bool Cache::evictLine(uint32_t address, CacheLine &flushedLine, uint32_t *flushedData) {
+    int loc = find(address);
+    if (loc < 0) {
+        return false;
     }
+    line[loc].valid = false;
+    flushedLine = line[loc];
+    if (flushedLine.dirty && !store) {
+        std::copy(&data[loc*lineWords], &data[loc*lineWords] + lineWords, flushedData);
+    }
+    return flushedLine.dirty;
 }
 
-// Invalidate a line
-void Cache::invalidateLine(uint32_t address) {
+// Check if the miss at this address was caused by a remote invalidation
+bool Cache::isCoherenceMiss(uint32_t address) {
     int idx = getIndex(address);
     int tag = getTag(address);
 
     for (int w=0; w<assoc; w++) {
-        if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-            line[idx*assoc+w].valid = false;
+        if (!line[idx*assoc+w].valid && line[idx*assoc+w].snooped && line[idx*assoc+w].tag == tag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Coherence: invalidate on a remote write, returns true and the line if it was dirty (M -> I)
+bool Cache::snoopInvalidate(uint32_t address, CacheLine &flushedLine, uint32_t *flushedData) {
+    int loc = find(address);
+    if (loc < 0) {
+        return false;
+    }
+    DEBUG(cout << name + " Cache: snoop invalidate at address " << std::hex << address << std::dec << "\n");
+    line[loc].valid = false;
+    line[loc].snooped = true;
+    stats.invalidations++;
+    flushedLine = line[loc];
+    if (flushedLine.dirty && !store) {
+        std::copy(&data[loc*lineWords], &data[loc*lineWords] + lineWords, flushedData);
+    }
+    return flushedLine.dirty;
+}
+
+// Coherence: downgrade on a remote read, returns true and the line if it was dirty (M -> S)
+bool Cache::snoopDowngrade(uint32_t address, CacheLine &flushedLine, uint32_t *flushedData) {
+    int loc = find(address);
+    if (loc < 0 || !line[loc].dirty) {
+        return false;
+    }
+    DEBUG(cout << name + " Cache: snoop downgrade at address " << std::hex << address << std::dec << "\n");
+    line[loc].dirty = false;
+    stats.downgrades++;
+    flushedLine = line[loc];
+    if (!store) {
+        std::copy(&data[loc*lineWords], &data[loc*lineWords] + lineWords, flushedData);
+    }
+    return true;
+}
+
+// Print hit/miss and coherence counters
+void Cache::printStats() {
+    cout << name << " hits: " << stats.hits << " misses: " << stats.misses;
+    if (stats.coherenceMisses || stats.invalidations || stats.downgrades) {
+        cout << " coherence misses: " << stats.coherenceMisses << " invalidations: " << stats.invalidations
+             << " downgrades: " << stats.downgrades;
+    }
+    if (stats.backInvalidations) {
+        cout << " back-invalidations: " << stats.backInvalidations;
+    }
+    if (stats.keptAbove) {
+        cout << " kept above: " << stats.keptAbove;
+    }
+    if (stats.victims || stats.movedUp) {
+        cout << " victims: " << stats.victims << " moved up: " << stats.movedUp;
+    }
+    if (stats.fillWaits) {
+        cout << " fill waits: " << stats.fillWaits;
+    }
+    cout << "\n" << name << " writebacks: " << stats.writebacks << " write-throughs: " << stats.writeThroughs
+         << " traffic: " << stats.trafficBytes << " bytes";
+    if (stats.coalesced || stats.bufferStalls) {
+        cout << " coalesced: " << stats.coalesced << " buffer stalls: " << stats.bufferStalls;
+    }
+    cout << "\n";
+}
+
+// MSI snooping: write back and downgrade/invalidate copies held by other cores
+// Instruction caches are never dirty: stores invalidate them in every core (including the
+// storing one) and instruction fills first collect dirty data from every L1D
+void Memory::snoop(int core, uint32_t address, bool mem_write, bool instr) {
+    uint32_t flushedData[MAX_LINE_SIZE/4];
+    for (int c = 0; c < (int)L1D.size(); c++) {
+        CacheLine flushedLine;
+        if (mem_write) {
+            L1I[c].snoopInvalidate(address, flushedLine, flushedData);
+        }
+        if (c == core && !instr) {
+            continue;
+        }
+        bool dirty = mem_write ? L1D[c].snoopInvalidate(address, flushedLine, flushedData) : L1D[c].snoopDowngrade(address, flushedLine, flushedData);
+        if (dirty) {
+            writeBack(0, flushedLine.address, flushedData, L1D[c].getLineWords());
+        }
+    }
+}
+
+// Send a store that leaves level lvl (write-through or bypassing a miss) down the hierarchy
+void Memory::writeThrough(int lvl, uint32_t address, uint32_t write_data) {
+    for (int k = lvl+1; k <= (int)levels.size(); k++) {
+        Cache &c = levels[k-1];
+        if (!c.writeWord(address, write_data)) {
+            // an exclusive level only allocates victims
+            if (!c.isWriteAllocate() || c.isExclusive()) {
+                continue;
+            }
+            // allocated off the critical path while the store drains from the write buffer
+            int src = k+1;
+            while (src <= (int)levels.size() && !levels[src-1].probe(address)) {
+                src++;
+            }
+            fill(c, k, src, address, -1);
+            c.writeWord(address, write_data);
+        }
+        if (c.isWriteBack()) {
+            return;
+        }
+        c.forwardWrite(address, 1);
+    }
+    mem[address/4] = write_data;
+    if (dram.enabled()) {
+        dram.post(address, true, sharedCycle);
+    }
+}
+
+// Write dirty words that leave level lvl into the first level below holding them, or memory
+void Memory::writeBack(int lvl, uint32_t address, const uint32_t *words, int numWords) {
+    for (int k = lvl+1; k <= (int)levels.size(); k++) {
+        if (levels[k-1].writeBackLine(address, words, numWords)) {
+            if (levels[k-1].isWriteBack()) {
+                return;
+            }
+            levels[k-1].forwardWrite(address, numWords);
+        }
+    }
+    for (int i = 0; !tagOnly && i < numWords; i++) {
+       mem[address/4+i] = words[i];
+    }
+    if (dram.enabled()) {
+        dram.post(address, true, sharedCycle);
+    }
+}
+
+// Remove the copies of an evicted line from one upper cache, merging their dirty words
+static void evictCopies(Cache &c, Cache &owner, CacheLine &evictedLine, uint32_t *evictedData, int numWords) {
+    uint32_t flushedData[MAX_LINE_SIZE/4];
+    for (uint32_t a = evictedLine.address; a < evictedLine.address + numWords*4; a += c.getLineSize()) {
+        CacheLine flushedLine;
+        if (!c.probe(a)) {
+            continue;
+        }
+        owner.countBackInvalidation();
+        if (c.evictLine(a, flushedLine, flushedData)) {
+            if (!c.isTagOnly()) {
+                std::copy(flushedData, flushedData + c.getLineWords(), evictedData + (a - evictedLine.address)/4);
+            }
+            evictedLine.dirty = true;
+        }
+    }
+}
+
+// Remove the copies of a line evicted from level lvl from all levels above it, the
+// levels nearest the cores last since they hold the newest data
+void Memory::backInvalidate(int lvl, CacheLine &evictedLine, uint32_t *evictedData, int numWords) {
+    Cache &owner = levels[lvl-1];
+    for (int k = lvl-1; k >= 1; k--) {
+        evictCopies(levels[k-1], owner, evictedLine, evictedData, numWords);
+    }
+    for (int c = 0; c < (int)L1D.size(); c++) {
+        evictCopies(L1I[c], owner, evictedLine, evictedData, numWords);
+        evictCopies(L1D[c], owner, evictedLine, evictedData, numWords);
+    }
+}
+
+// Fill the line holding this address into upper (at level lvl) from level src
+int Memory::fill(Cache &upper, int lvl, int src, uint32_t address, int port) {
+    uint32_t lineAddr = upper.getLineAddress(address);
+    const uint32_t *newData = src <= (int)levels.size() ? levels[src-1].findWords(lineAddr) : nullptr;
+    if (!newData || tagOnly) {
+        newData = &mem[lineAddr/4];
+        // demand reads were timed by the DRAM model before the fill, background fills just load it
+        if (port < 0 && dram.enabled()) {
+            dram.post(lineAddr, false, sharedCycle);
+        }
+    }
+    CacheLine evictedLine;
+    uint32_t evictedData[MAX_LINE_SIZE/4];
+    evictedLine.valid = false;
+    DEBUG(print(lineAddr/4, upper.getLineWords()));
+    bool present = upper.probe(address);
+    upper.replace(address, newData, evictedLine, evictedData);
+    if (port >= 0) {
+        upper.markRefilled(address, lvl == 0 ? l1Port(port) : port);
+    }
+
+    // a demand refill timed by the miss penalty arrives critical word first; lines from the
+    // DRAM model (its own burst) and multicore L1 fills (completed with the access) arrive whole
+    bool timedByDram = src > (int)levels.size() && dram.enabled();
+    if (!present && port >= 0 && !timedByDram && !(lvl == 0 && L1D.size() > 1)) {
+        upper.startBurst(address, lvl == 0 ? l1Port(port) : port);
+    }
+
+    // an exclusive level hands the line up and drops it; its dirty words go along, or below
+    // it if the level above is write-through
+    if (!present && src <= (int)levels.size() && levels[src-1].isExclusive()) {
+        Cache &lower = levels[src-1];
+        CacheLine movedLine;
+        uint32_t movedData[MAX_LINE_SIZE/4];
+        lower.countMovedUp();
+        if (lower.evictLine(lineAddr, movedLine, movedData)) {
+            if (upper.isWriteBack()) {
+                upper.writeBackLine(lineAddr, movedData, lower.getLineWords());
+            } else {
+                writeBack(src, lineAddr, movedData, lower.getLineWords());
+            }
+        }
+    }
+    if (!evictedLine.valid) {
+        return 0;
+    }
+    int stall = evict(upper, lvl, evictedLine, evictedData);
+    if (port >= 0) {
+        upper.addStall(lvl == 0 ? l1Port(port) : port, stall);
+    }
+    return stall;
+}
+
+// Check if a level above lvl holds part of this line
+bool Memory::heldAbove(int lvl, uint32_t address, int numWords) {
+    for (int k = 1; k < lvl; k++) {
+        for (uint32_t a = address; a < address + numWords*4; a += levels[k-1].getLineSize()) {
+            if (levels[k-1].probe(a)) {
+                return true;
+            }
+        }
+    }
+    for (int c = 0; c < (int)L1D.size(); c++) {
+        for (uint32_t a = address; a < address + numWords*4; a += L1D[c].getLineSize()) {
+            if (L1D[c].probe(a) || L1I[c].probe(a)) {
+                return true;
+            }
         }
     }
+    return false;
+}
+
+// Handle the victim of c (at level lvl): an inclusive level takes its copies out of the levels
+// above, and the victim moves into an exclusive level below or is written back if dirty
+int Memory::evict(Cache &c, int lvl, CacheLine &evictedLine, uint32_t *evictedData) {
+    if (lvl > 0 && c.isInclusive()) {
+        backInvalidate(lvl, evictedLine, evictedData, c.getLineWords());
+    } else if (lvl > 0 && !c.isExclusive() && heldAbove(lvl, evictedLine.address, c.getLineWords())) {
+        c.countKeptAbove();
+    }
+    bool victimCache = lvl < (int)levels.size() && levels[lvl].isExclusive();
+    if (victimCache) {
+        spill(lvl+1, evictedLine, evictedData);
+    }
+
+    // writeback dirty line, the refill waits for it unless the writeback buffer takes it
+    if (!evictedLine.dirty) {
+        return 0;
+    }
+    if (!victimCache) {
+        writeBack(lvl, evictedLine.address, evictedData, c.getLineWords());
+    }
+    return c.queueWriteback(evictedLine.address);
 }
 
-bool Memory::access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write) {
+// Insert a line evicted from the level above into the exclusive level lvl, clean or dirty. Its
+// own victim is handled off the critical path of the refill that caused the spill.
+void Memory::spill(int lvl, CacheLine &victim, const uint32_t *words) {
+    Cache &victims = levels[lvl-1];
+    CacheLine evictedLine;
+    uint32_t evictedData[MAX_LINE_SIZE/4];
+    evictedLine.valid = false;
+    victims.countVictim();
+    victims.replace(victim.address, words, evictedLine, evictedData);
+    if (victim.dirty) {
+        if (victims.isWriteBack()) {
+            victims.writeBackLine(victim.address, words, victims.getLineWords());
+        } else {
+            writeBack(lvl, victim.address, words, victims.getLineWords());
+        }
+    }
+    if (evictedLine.valid) {
+        evict(victims, lvl, evictedLine, evictedData);
+    }
+}
+
+// Advance the write and writeback buffers seen by a hardware thread by one cycle; the contexts
+// of a core share its L1s, which follow the fastest of them
+void Memory::tick(int thread) {
     if (opt_level == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (threadCycle.size() > 1) {
+        guard.lock();
+    }
+    int core = thread / contexts;
+    if (++threadCycle[thread] <= coreCycle[core]) {
+        return;
+    }
+    L1I[core].tick();
+    L1D[core].tick();
+    coreCycle[core] = threadCycle[thread];
+    if (coreCycle[core] > sharedCycle) {
+        sharedCycle = coreCycle[core];
+        for (int k = 0; k < (int)levels.size(); k++) {
+            levels[k].tick();
+        }
+        if (dram.enabled()) {
+            dram.tick(sharedCycle);
+        }
+    }
+}
+
+void Memory::printStats() {
+    for (int c = 0; c < (int)L1D.size(); c++) {
+        L1I[c].printStats();
+        L1D[c].printStats();
+    }
+    for (int k = 0; k < (int)levels.size(); k++) {
+        levels[k].printStats();
+    }
+    if (dram.enabled()) {
+        dram.printStats();
+    }
+    for (int c = 0; c < (int)DTLB.size(); c++) {
+        ITLB[c].printStats();
+        DTLB[c].printStats();
+    }
+    if (vm.enabled && L2TLB.enabled()) {
+        L2TLB.printStats();
+    }
+    if (vm.enabled) {
+        cout << "Page walks: " << walkStats.walks << " entries read: " << walkStats.reads;
+        if (walkStats.walks) {
+            cout << " avg walk latency: " << (double)walkStats.cycles / walkStats.walks;
+        }
+        cout << "\n";
+    }
+}
+
+void Memory::resetStats() {
+    for (int c = 0; c < (int)L1D.size(); c++) {
+        L1I[c].resetStats();
+        L1D[c].resetStats();
+    }
+    for (int k = 0; k < (int)levels.size(); k++) {
+        levels[k].resetStats();
+    }
+    dram.resetStats();
+    for (int c = 0; c < (int)DTLB.size(); c++) {
+        ITLB[c].resetStats();
+        DTLB[c].resetStats();
+    }
+    L2TLB.resetStats();
+    walkStats = WalkStats();
+}
+
+// Build the page table of a hardware thread; threads of one region share the first one's
+void Memory::mapPages(int thread) {
+    for (int t = 0; t < thread; t++) {
+        if (coreBase[t] == coreBase[thread]) {
+            pageTable[thread] = pageTable[t];
+            asid[thread] = asid[t];
+            return;
+        }
+    }
+    pageTable[thread] = tableTop;
+    asid[thread] = thread;
+    tableTop += 4u << (32-pageBits-leafBits);
+    uint32_t pages = (memSize - coreBase[thread]) >> pageBits;
+    for (uint32_t vpn = 0; vpn < pages; vpn++) {
+        uint32_t &root = mem[pageTable[thread]/4 + (vpn >> leafBits)];
+        if (!root) {
+            root = tableTop | 1;
+            tableTop += 4u << leafBits;
+        }
+        mem[(root & ~3u)/4 + (vpn & ((1u << leafBits)-1))] = ((coreBase[thread] >> pageBits) + vpn) << pageBits | 1;
+    }
+}
+
+// Physical address of a virtual one, read from the thread's page table without timing
+uint32_t Memory::walkTable(int thread, uint32_t address) {
+    uint32_t vpn = address >> pageBits;
+    uint32_t root = mem[pageTable[thread]/4 + (vpn >> leafBits)];
+    uint32_t leaf = root & 1 ? mem[(root & ~3u)/4 + (vpn & ((1u << leafBits)-1))] : 0;
+    if (!(leaf & 1)) {
+        cout << "Page fault: thread " << thread << " address " << std::hex << address << std::dec << "\n";
+        exit(1);
+    }
+    return (leaf & ~((1u << pageBits)-1)) | (address & ((1u << pageBits)-1));
+}
+
+// Translate through the L1 TLB of one side, then the L2 TLB after its latency, then a walk of
+// the two page table levels whose entries are read through the L1D like loads. The walk belongs
+// to the translation of the side that missed, which completes it even if the access it started
+// for went away (a squashed fetch); the next call then translates the new page.
+bool Memory::translate(int thread, bool instr, uint32_t &address) {
+    int core = thread / contexts;
+    Tlb &l1 = instr ? ITLB[core] : DTLB[core];
+    uint32_t vpn = address >> pageBits;
+    uint32_t offset = address & ((1u << pageBits)-1);
+    uint32_t pfn = 0;
+    TlbMiss &m = tlbMiss[2*thread + instr];
+    if (!m.active) {
+        if (l1.lookup(asid[thread], vpn, pfn)) {
+            address = pfn << pageBits | offset;
+            return true;
+        }
+        l1.countMiss();
+        m = {true, true, vpn, 0, L2TLB.enabled() ? L2TLB.getLatency() : 0, 0, 0, threadCycle[thread]};
+        std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+        if (threadCycle.size() > 1) {
+            guard.lock();
+        }
+        if (L2TLB.lookup(asid[thread], vpn, m.pfn)) {
+            L2TLB.countHit();
+            m.level = -1;
+        } else if (L2TLB.enabled()) {
+            L2TLB.countMiss();
+        }
+        m.entry = pageTable[thread] + 4*(vpn >> leafBits);
+    }
+    if (m.countdown > 0) {
+        m.countdown--;
+        return false;
+    }
+    if (m.level >= 0) {
+        uint32_t pte = 0;
+        if (!accessL1(L1D[core], 4*thread + 2 + instr, m.entry, pte, 0, true, false, core, false)) {
+            return false;
+        }
+        std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+        if (threadCycle.size() > 1) {
+            guard.lock();
+        }
+        walkStats.reads++;
+        if (!(pte & 1)) {
+            cout << "Page fault: thread " << thread << " address " << std::hex << (m.vpn << pageBits) << std::dec << "\n";
+            exit(1);
+        }
+        if (m.level == 0) {
+            m.entry = (pte & ~3u) + 4*(m.vpn & ((1u << leafBits)-1));
+            m.level = 1;
+            return false;
+        }
+        m.pfn = pte >> pageBits;
+        L2TLB.insert(asid[thread], m.vpn, m.pfn);
+        walkStats.walks++;
+        walkStats.cycles += threadCycle[thread] - m.start;
+    }
+    l1.insert(asid[thread], m.vpn, m.pfn);
+    m.active = false;
+    // the access that missed went away: the next translation of this side is a new lookup
+    if (m.vpn != vpn) {
+        m.missed = false;
+        return false;
+    }
+    address = m.pfn << pageBits | offset;
+    return true;
+}
+
+// Walk the hierarchy from one L1 (instruction or data side of a core); port is its port below L1
+bool Memory::accessL1(Cache &l1, int port, uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, int core, bool instr) {
+    // Only the multicore configuration keeps L1s coherent; any run with more than one hardware
+    // thread may share the hierarchy between host threads
+    bool shared = L1D.size() > 1;
+    int l1port = l1Port(port);
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (threadCycle.size() > 1) {
+        guard.lock();
+    }
+    accessCycle = coreCycle[core];
+    // write to a shared line: invalidate the other copies first (S -> M upgrade)
+    if (mem_write && l1.probe(address)) {
+        snoop(core, address, true, instr);
+    }
+
+    // no-write-allocate: a store miss bypasses L1 through its write buffer
+    if (mem_write && !l1.isWriteAllocate() && !l1.probe(address)) {
+        if (!l1.postWrite(address)) {
+            return false;
+        }
+        snoop(core, address, true, instr);
+        writeThrough(0, address, write_data);
+        return true;
+    }
+
+    if ((mem_read && l1.read(address, read_data, l1port)) || (mem_write && l1.write(address, write_data, l1port))) {
+        if (mem_write && !l1.isWriteBack()) {
+            writeThrough(0, address, write_data);
+        }
+        return true;
+    }
+    // the line is arriving critical word first: wait for this word, nothing to ask below
+    if (l1.isFilling(address)) {
+        return false;
+    }
+    // the line is already in L1 and only its miss penalty is left: walking again would count
+    // the same miss as hits below (coherent L1s complete the access on the fill instead)
+    if (!shared && l1.probe(address)) {
+        return false;
+    }
+
+    // Walk down until a level holds the line (memory always does). It fills the level right
+    // above it; the levels above that keep missing until the line has moved up to L1.
+    // Don't return a success status until miss penalty is paid off completely
+    // Tag-only caches share one copy of the data, which the store may only change once it
+    // completes in L1 (after the other copies are invalidated): the walk rewrites the old value
+    uint32_t walk_data = tagOnly && mem_write ? mem[address/4] : write_data;
+    int src = 1;
+    bool carry = false;
+    for (; src <= (int)levels.size(); src++) {
+        Cache &c = levels[src-1];
+        // an exclusive level already handed the line up, which is still paying its miss penalty
+        if (c.isExclusive() && (src == 1 ? l1 : levels[src-2]).probe(address)) {
+            return false;
+        }
+        // an exclusive level that missed passes the line from below once its lookup is over
+        if (c.isExclusive() && c.passWaiting(address, port)) {
+            return false;
+        }
+        if (c.isExclusive() && c.passOver(address, port)) {
+            continue;
+        }
+        // the line filled here for this requester was evicted by another one missing in the same
+        // set before it moved up: take it from below again and carry it up to L1 in this call, so
+        // that more requesters than ways still all get their lines
+        if (c.lostRefill(address, port)) {
+            carry = true;
+            continue;
+        }
+        if ((mem_read && c.read(address, read_data, port)) || (mem_write && c.write(address, walk_data, port))) {
+            if (mem_write && !c.isWriteBack()) {
+                writeThrough(src, address, walk_data);
+            }
+            break;
+        }
+        if (c.isFilling(address)) {
+            return false;
+        }
+    }
+    // lines from below bypass exclusive levels; one that holds the line while this requester
+    // still waits for it is the source instead. The requester still pays the lookup in the
+    // levels it bypasses, as it would if they were filled on the way up, before the line is
+    // read from below.
+    int lvl = src-1;
+    bool passing = false;
+    while (lvl > 0 && levels[lvl-1].isExclusive()) {
+        if (levels[lvl-1].probe(address)) {
+            src = lvl;
+        } else if (src > (int)levels.size() && dram.enabled()) {
+            // the DRAM model times the read from memory instead of the miss penalty, as it
+            // does for the inclusive level right above it
+            levels[lvl-1].completeMiss(port);
+        } else {
+            passing |= levels[lvl-1].startPass(address, port);
+        }
+        lvl--;
+    }
+    if (passing) {
+        return false;
+    }
+    Cache &upper = lvl == 0 ? l1 : levels[lvl-1];
+
+    // With the DRAM model, memory answers when the controller has scheduled the read;
+    // the level above it keeps missing until then
+    if (src > (int)levels.size() && dram.enabled()) {
+        int upperPort = lvl == 0 ? l1port : port;
+        if (!dram.busy(port)) {
+            if (dram.read(upper.getLineAddress(address), port, sharedCycle)) {
+                upper.holdMiss(upperPort);
+            }
+            return false;
+        }
+        if (!dram.done(port, sharedCycle)) {
+            return false;
+        }
+        upper.completeMiss(upperPort);
+    }
+    if (lvl == 0 && (shared || instr)) {
+        snoop(core, address, mem_write, instr);
+    }
+    int stall = fill(upper, lvl, src, address, port);
+    while (carry && lvl > 0) {
+        levels[lvl-1].forgetMiss(port);
+        src = lvl;
+        for (lvl--; lvl > 0 && levels[lvl-1].isExclusive(); lvl--) {
+        }
+        if (lvl == 0 && (shared || instr)) {
+            snoop(core, address, mem_write, instr);
+        }
+        stall += fill(lvl == 0 ? l1 : levels[lvl-1], lvl, src, address, port);
+    }
+
+    // With coherence the fill and the access complete together, so a remote
+    // write cannot steal the line before this core has used it
+    if (lvl == 0 && shared && !stall) {
+        l1.completeMiss(l1port);
+        if (mem_read) {
+            return l1.read(address, read_data, l1port);
+        }
+        if (l1.write(address, write_data, l1port)) {
+            if (!l1.isWriteBack()) {
+                writeThrough(0, address, write_data);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Memory::access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, int thread) {
+    HOST_PROFILE_SCOPE(HOST_MEMORY_ACCESS);
+    if (opt_level == 0) {
+        // the single-cycle model calls for every instruction, with an ALU result as address
+        address = vm.enabled && (mem_read || mem_write) ? walkTable(thread, address) : address + coreBase[thread];
         if (mem_read) {
             read_data = mem[address/4];
         }
@@ -154,42 +865,40 @@ bool Memory::access(uint32_t address, uint32_t &read_data, uint32_t write_data,
     if (!mem_read && !mem_write) {
         return true;
     }
+    int core = thread / contexts;
+    if (!vm.enabled) {
+        return accessL1(L1D[core], 4*thread, address + coreBase[thread], read_data, write_data, mem_read, mem_write, core, false);
+    }
+    // an L1 TLB hit counts once the access completes, not while it waits for the cache
+    TlbMiss &m = tlbMiss[2*thread];
+    if (!translate(thread, false, address) ||
+        !accessL1(L1D[core], 4*thread, address, read_data, write_data, mem_read, mem_write, core, false)) {
+        return false;
+    }
+    if (!m.missed) {
+        DTLB[core].countHit();
+    }
+    m.missed = false;
+    return true;
+}
 
-    if ((mem_read && L1.read(address, read_data)) || (mem_write && L1.write(address, write_data))) {
+bool Memory::fetch(uint32_t address, uint32_t &instruction, int thread) {
+    HOST_PROFILE_SCOPE(HOST_MEMORY_ACCESS);
+    if (opt_level == 0) {
+        instruction = mem[(vm.enabled ? walkTable(thread, address) : address + coreBase[thread])/4];
         return true;
-    } else if ((mem_read && L2.read(address, read_data)) || (mem_write && L2.write(address, write_data))) {
-        // Read from L2 but don't return a success status until miss penalty is paid off completely
-        CacheLine evictedLine;
-        L1.replace(address, L2.readLine(address), evictedLine);
-
-        // writeback dirty line
-        if (evictedLine.valid && evictedLine.dirty) {
-            L2.writeBackLine(evictedLine);
-        }
-    } else {
-        // Read from memory but don't return a success status until miss penalty is paid off completely
-        int lineAddr = address & ~(CACHE_LINE_SIZE-1);
-        CacheLine c;
-        CacheLine evictedLine;
-        evictedLine.valid = false;
-        DEBUG(print(lineAddr, 8));
-        for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-           c.data[i] = mem[lineAddr/4+i];
-        }
-        L2.replace(address, c, evictedLine); 
-
-        // model an inclusive hierarchy
-        if (evictedLine.valid) {
-            L1.invalidateLine(evictedLine.address);
-        }
-
-        // writeback dirty line
-        if (evictedLine.valid && evictedLine.dirty) {
-            lineAddr = evictedLine.address & ~(CACHE_LINE_SIZE-1);
-            for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-               mem[lineAddr/4+i] = evictedLine.data[i];
-            }
-        }
     }
-    return false;
+    int core = thread / contexts;
+    if (!vm.enabled) {
+        return accessL1(L1I[core], 4*thread+1, address + coreBase[thread], instruction, 0, true, false, core, true);
+    }
+    TlbMiss &m = tlbMiss[2*thread+1];
+    if (!translate(thread, true, address) || !accessL1(L1I[core], 4*thread+1, address, instruction, 0, true, false, core, true)) {
+        return false;
+    }
+    if (!m.missed) {
+        ITLB[core].countHit();
+    }
+    m.missed = false;
+    return true;
 }
@@ -4,93 +4,487 @@
 #include <cstdint>
 #include <iostream>
 #include <cmath>
+#include <string>
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include "replacement.h"
+#include "dram.h"
+#include "tlb.h"
 
-#define CACHE_LINE_SIZE 64
+#define MAX_LINE_SIZE 256
 
+// Line data lives in the owning Cache, so line sizes can differ between levels
 struct CacheLine {
-    uint32_t data[CACHE_LINE_SIZE/4];
     uint32_t address;
     int tag;
     bool valid;
     bool dirty;
-    uint8_t replBits;
+    bool snooped;            // invalidated by a remote write (MSI: I state reached through coherence)
+    uint64_t burstStart;     // critical word first: cycle the first word of the refill arrives
+    int criticalWord;        // word of the line that arrives first
+};
+
+// MSI state is encoded in the existing bits: I = !valid, S = valid && !dirty, M = valid && dirty
+struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t coherenceMisses;    // misses to a line that was lost to a remote invalidation
+    uint64_t invalidations;      // lines invalidated by remote writes
+    uint64_t downgrades;         // M lines written back and downgraded to S by remote reads
+    uint64_t writebacks;         // dirty lines evicted to the next level
+    uint64_t writeThroughs;      // stores sent to the next level (write-through or bypassing a miss)
+    uint64_t trafficBytes;       // bytes written to the next level by writebacks and stores
+    uint64_t coalesced;          // stores merged into a pending write buffer entry
+    uint64_t bufferStalls;       // stores or evictions that found their buffer full
+    uint64_t backInvalidations;  // lines removed from upper levels to keep this level inclusive
+    uint64_t keptAbove;          // non-inclusive: evicted lines left in upper levels
+    uint64_t victims;            // exclusive: lines received from upper level evictions
+    uint64_t movedUp;            // exclusive: hits handed to the level above and dropped here
+    uint64_t fillWaits;          // cycles an access waited for its word of a line still filling
+};
+
+// Write policy of one cache level
+struct WritePolicy {
+    bool writeBack;              // 0: write-through, every store is also sent to the next level
+    bool writeAllocate;          // 0: no-write-allocate, store misses bypass this level
+    int writeBufferSize;         // coalescing entries for stores sent to the next level (at least 1)
+    int writebackBufferSize;     // entries for dirty evictions, 0 writes back before the refill
+};
+
+// How a shared level relates to the levels above it
+enum InclusionPolicy {
+    INCLUSIVE,                   // evictions back-invalidate the copies above
+    NON_INCLUSIVE,               // evictions leave the copies above alone
+    EXCLUSIVE                    // victim cache of the levels above: filled by their evictions,
+                                 // lines from below bypass it and hits move up
+};
+
+// Geometry, latency and policies of one cache level
+struct CacheConfig {
+    std::string name;
+    int size;
+    int assoc;
+    int lineSize;
+    int missPenalty;
+    InclusionPolicy inclusion;
+    std::string repl;
+    WritePolicy write;
+    int fillWidth;               // bytes per cycle of a critical-word-first refill, 0: whole line at once
+};
+
+// Private L1I/L1D per core, followed by any number of shared levels (nearest first) and memory.
+// Line sizes may only grow going down the hierarchy.
+struct HierarchyConfig {
+    CacheConfig l1i;
+    CacheConfig l1d;
+    std::vector<CacheConfig> levels;
+    DramConfig dram;
+    bool tagOnly;               // caches keep tags and state only, data stays in memory
+    VirtualMemoryConfig vm;
+
+    HierarchyConfig() {
+        l1i = {"L1I", 32768, 8, 64, 12, INCLUSIVE, "lru", {true, true, 1, 0}, 0};
+        l1d = {"L1D", 32768, 8, 64, 12, INCLUSIVE, "lru", {true, true, 1, 0}, 0};
+        levels.push_back({"L2", 262144, 8, 64, 59, INCLUSIVE, "lru", {true, true, 1, 0}, 0});
+        dram = {0, 2048, 14, 14, 14, 4, true, 16};
+        tagOnly = false;
+        vm = {false, 4096, {"ITLB", 64, 4, 0}, {"DTLB", 64, 4, 0}, {"L2TLB", 1024, 8, 8}};
+    }
+};
+
+// Line-granular buffer draining to the next level, one entry every drainLatency cycles.
+// Data is applied to the next level when an entry is queued; the buffer models occupancy only.
+class WriteBuffer {
+    private:
+        struct Entry {
+            uint32_t lineAddr;
+            uint64_t wordMask;
+        };
+        std::deque<Entry> entries;
+        int capacity;
+        int drainLatency;
+        int drainCountdown;
+    public:
+        WriteBuffer() : capacity(0), drainLatency(0), drainCountdown(0) {}
+
+        void configure(int entries, int latency) {
+            capacity = entries;
+            drainLatency = latency;
+        }
+        bool enabled() { return capacity > 0; }
+        bool full() { return (int)entries.size() >= capacity; }
+
+        // Entry holding this line, or -1
+        int find(uint32_t lineAddr) {
+            for (int i = 0; i < (int)entries.size(); i++) {
+                if (entries[i].lineAddr == lineAddr) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        // Check if a store to this line can be accepted this cycle
+        bool canAccept(uint32_t lineAddr) {
+            return !full() || find(lineAddr) >= 0;
+        }
+
+        // Queue words of a line, merging with a pending entry for the same line
+        // returns the number of words that were not already pending
+        int push(uint32_t lineAddr, uint64_t wordMask) {
+            int i = find(lineAddr);
+            if (i < 0) {
+                if (entries.empty()) {
+                    drainCountdown = drainLatency;
+                }
+                entries.push_back({lineAddr, wordMask});
+                return __builtin_popcountll(wordMask);
+            }
+            int added = __builtin_popcountll(wordMask & ~entries[i].wordMask);
+            entries[i].wordMask |= wordMask;
+            return added;
+        }
+
+        // Cycles until the head entry has drained
+        int cyclesToFree() {
+            return entries.empty() ? 0 : drainCountdown;
+        }
+
+        // Retire the head entry now (its drain time has been charged elsewhere)
+        void pop() {
+            entries.pop_front();
+            drainCountdown = drainLatency;
+        }
+
+        // Advance one cycle
+        void tick() {
+            if (!entries.empty() && --drainCountdown <= 0) {
+                pop();
+            }
+        }
 };
 
 class Cache {
     private:
         std::vector<CacheLine> line;
+        std::vector<uint32_t> data;         // lineWords words per line, empty when tag-only
+        uint32_t *store;                    // tag-only: memory, which holds the data of every line
         int size;
         int assoc;
+        int lineSize;
+        int lineWords;
+        int numSets;
+        int offsetBits;
+        int indexBits;
+        std::unique_ptr<ReplacementPolicy> repl;
         int missPenalty;
-        int missCountdown;
+        std::vector<int> missCountdown;     // one outstanding miss per requester port
+        std::vector<int64_t> missLine;      // line each port is refilling, -1 if none
+        std::vector<bool> refilled;         // that line has been filled here for the port
+        std::vector<int64_t> passLine;      // exclusive: line passing through to the level above per port
+        std::vector<bool> passDone;         // its lookup here is over
         std::string name;
+        CacheStats stats;
+        WritePolicy policy;
+        InclusionPolicy inclusion;
+        WriteBuffer writeBuffer;            // stores on their way to the next level
+        WriteBuffer writebackBuffer;        // dirty evictions on their way to the next level
+        int beatWords;                      // words per refill cycle, 0 without critical word first
+        int earlyRestart;                   // cycles a miss ends before the whole line is in
+        const uint64_t *clock;              // cycle count this level is timed by
+
+        // Location of the valid line holding this address, -1 if absent
+        int find(uint32_t address);
+
+        // Check if the miss at this address was caused by a remote invalidation
+        bool isCoherenceMiss(uint32_t address);
+
+        // A requester probes again while its refill is on the way (the level below may still be
+        // filling): count one miss per refill, and not the hit that ends it
+        void countMiss(uint32_t address, int port) {
+            if (missLine[port] != getLineAddress(address)) {
+                stats.misses++;
+                stats.coherenceMisses += isCoherenceMiss(address);
+                missLine[port] = getLineAddress(address);
+                refilled[port] = false;
+            }
+        }
+        void countHit(uint32_t address, int port) {
+            if (missLine[port] != getLineAddress(address)) {
+                stats.hits++;
+            }
+            missLine[port] = -1;
+            refilled[port] = false;
+        }
+
+        // Cycle the word at this address of the line at loc arrives (wrap-around from the critical word)
+        uint64_t wordArrival(int loc, uint32_t address) {
+            int beat = ((getOffset(address)/4 - line[loc].criticalWord + lineWords) % lineWords) / beatWords;
+            return line[loc].burstStart + beat;
+        }
     public:
-        Cache(std::string nm, int sz, int asc, int penalty) {
-            name = nm;
-            size = sz;
-            assoc = asc;
-            line.resize(size/CACHE_LINE_SIZE);
+        Cache(const CacheConfig &config) {
+            name = config.name;
+            size = config.size;
+            assoc = config.assoc;
+            lineSize = config.lineSize;
+            lineWords = lineSize/4;
+            numSets = size/(lineSize*assoc);
+            offsetBits = (int)log2(lineSize);
+            indexBits = (int)log2(numSets);
+            line.resize(size/lineSize);
+            data.resize(size/4, 0);
+            store = nullptr;
 
-            for (int i = 0; i < (size/CACHE_LINE_SIZE); i++) {
+            for (int i = 0; i < (size/lineSize); i++) {
                 line[i].valid = false;
+                line[i].snooped = false;
+                line[i].burstStart = 0;
             }
             
-            missCountdown = 0;
-            missPenalty = penalty;
+            stats = CacheStats();
+            missCountdown.resize(1, 0);
+            missLine.resize(1, -1);
+            refilled.resize(1, false);
+            passLine.resize(1, -1);
+            passDone.resize(1, false);
+            missPenalty = config.missPenalty;
+            inclusion = config.inclusion;
+            repl.reset(new LRUPolicy(numSets, assoc));
+            setReplacementPolicy(config.repl);
+            setWritePolicy(config.write);
+            clock = nullptr;
+            setFillWidth(config.fillWidth);
+        }
+
+        // Select the replacement policy by name, returns false if it is unknown for this geometry
+        bool setReplacementPolicy(const std::string &policy) {
+            ReplacementPolicy *p = makeReplacementPolicy(policy, numSets, assoc);
+            if (!p) {
+                return false;
+            }
+            repl.reset(p);
+            return true;
+        }
+
+        // Buffers drain to the next level at the cost of reaching it, i.e. this level's miss penalty
+        void setWritePolicy(WritePolicy p) {
+            policy = p;
+            writeBuffer.configure(std::max(1, p.writeBufferSize), missPenalty);
+            writebackBuffer.configure(p.writebackBufferSize, missPenalty);
+        }
+        // Keep tags, valid/dirty and replacement state only: hits read and write the words in
+        // memory and fills, evictions and writebacks move no data. Timing is unchanged, as memory
+        // always holds the newest value once stores are applied to it directly.
+        void setBackingStore(uint32_t *words) {
+            store = words;
+            std::vector<uint32_t>().swap(data);
         }
+        bool isTagOnly() { return store != nullptr; }
 
-        // offset, index, tag computation
+        // Refill lines critical word first, bytes per cycle (0: the whole line arrives at once).
+        // A miss ends when the requested word arrives, missPenalty less one cycle per further
+        // beat of the line; the other words follow in wrap-around order.
+        void setFillWidth(int bytes) {
+            beatWords = bytes ? std::min(std::max(bytes/4, 1), lineWords) : 0;
+            earlyRestart = beatWords ? std::min(lineWords/beatWords - 1, missPenalty - 1) : 0;
+        }
+        void setClock(const uint64_t *cycle) { clock = cycle; }
+
+        // The line holding address was just filled for this port: its words arrive one beat
+        // per cycle, the word at address first, once the port's miss is over
+        void startBurst(uint32_t address, int port) {
+            int loc = find(address);
+            if (beatWords && loc >= 0) {
+                line[loc].burstStart = *clock + missCountdown[port] + 1;
+                line[loc].criticalWord = getOffset(address)/4;
+            }
+        }
+
+        // Check if the line holding address is present but this word has not arrived yet
+        bool isFilling(uint32_t address) {
+            int loc = beatWords ? find(address) : -1;
+            return loc >= 0 && *clock < wordArrival(loc, address);
+        }
+
+        bool isWriteBack() { return policy.writeBack; }
+        bool isWriteAllocate() { return policy.writeAllocate; }
+        bool isInclusive() { return inclusion == INCLUSIVE; }
+        bool isExclusive() { return inclusion == EXCLUSIVE; }
+        int getLineSize() { return lineSize; }
+        int getLineWords() { return lineWords; }
+        void countBackInvalidation() { stats.backInvalidations++; }
+        void countKeptAbove() { stats.keptAbove++; }
+        void countVictim() { stats.victims++; }
+        void countMovedUp() { stats.movedUp++; }
+
+        // offset, index (set), tag computation
         int getOffset(uint32_t address) {
-            return address & (CACHE_LINE_SIZE-1);
+            return address & (lineSize-1);
         }
         int getIndex(uint32_t address) {
-            return (address >> (int)log2(CACHE_LINE_SIZE)) & (size/CACHE_LINE_SIZE-1);
+            return (address >> offsetBits) & (numSets-1);
         }
         int getTag(uint32_t address) {
-            return address >> (int)log2(size);
+            return address >> (offsetBits + indexBits);
+        }
+        uint32_t getLineAddress(uint32_t address) {
+            return address & ~(lineSize-1);
         }
 
         // Check if hit in the cache
         bool isHit(uint32_t address, uint32_t &loc);
 
-        // Update replacement bits after access
+        // Update replacement state after access
         void updateReplacementBits(int idx, int way);
 
+        // A shared cache tracks the outstanding miss of each requester separately
+        void setPorts(int num_ports) {
+            missCountdown.resize(num_ports, 0);
+            missLine.resize(num_ports, -1);
+            refilled.resize(num_ports, false);
+            passLine.resize(num_ports, -1);
+            passDone.resize(num_ports, false);
+        }
+
+        // Keep a requester missing until completeMiss(), used while memory answers through the DRAM model
+        void holdMiss(int port) {
+            missCountdown[port] = INT32_MAX;
+        }
+
+        // Drop the remaining miss penalty of a requester, used once its fill is complete
+        void completeMiss(int port = 0) {
+            missCountdown[port] = 0;
+        }
+
+        // Note a fill of the line a requester is missing on, which it reads once its penalty is paid
+        void markRefilled(uint32_t address, int port) {
+            refilled[port] = refilled[port] || missLine[port] == getLineAddress(address);
+        }
+
+        // Check if the line filled for a requester that has paid its penalty was evicted before it
+        // read it (another requester filled the same set meanwhile)
+        bool lostRefill(uint32_t address, int port) {
+            return refilled[port] && missLine[port] == getLineAddress(address) && !missCountdown[port] && !probe(address);
+        }
+
+        // Forget the refill of a requester that got its line some other way
+        void forgetMiss(int port) {
+            missLine[port] = -1;
+            refilled[port] = false;
+        }
+
+        // Check if the line is present without touching replacement state
+        bool probe(uint32_t address) {
+            return find(address) >= 0;
+        }
+
+        // Pointer to the word at this address inside its present line, nullptr if absent
+        uint32_t *findWords(uint32_t address) {
+            int loc = find(address);
+            return loc < 0 ? nullptr : store ? &store[address/4] : &data[loc*lineWords + getOffset(address)/4];
+        }
+
         // Read a word from this cache
-        bool read(uint32_t address, uint32_t &read_data);
+        bool read(uint32_t address, uint32_t &read_data, int port = 0);
 
         // Write a word to this cache
-        bool write(uint32_t address, uint32_t write_data);
+        bool write(uint32_t address, uint32_t write_data, int port = 0);
+
+        // Write a word into a present line without timing, returns false if the line is absent
+        bool writeWord(uint32_t address, uint32_t write_data);
+
+        // Send a store to the next level through the write buffer, returns false if the buffer is full
+        bool postWrite(uint32_t address);
+
+        // Send words of a line to the next level on behalf of an upper level; never refused,
+        // a full buffer retires its oldest entry early
+        void forwardWrite(uint32_t address, int numWords);
+
+        // Account a dirty eviction from this level, returns the cycles the refill has to wait
+        // for it (no writeback buffer, or a full one)
+        int queueWriteback(uint32_t address);
+
+        // Exclusive level: a line that missed here comes from below straight into the level
+        // above, once the lookup here is over (the miss penalty armed by the miss). While it lasts,
+        // counts it down and returns true.
+        bool passWaiting(uint32_t address, int port) {
+            if (passLine[port] != getLineAddress(address) || passDone[port]) {
+                return false;
+            }
+            if (missCountdown[port]) {
+                missCountdown[port]--;
+                return true;
+            }
+            passDone[port] = true;
+            return false;
+        }
+
+        // Check if the lookup of the line passing through for this port is over
+        bool passOver(uint32_t address, int port) {
+            return passLine[port] == getLineAddress(address) && passDone[port];
+        }
+
+        // Let a line from below pass through to the level above; returns false, and forgets it,
+        // if its lookup here is already over, true if the requester has to wait for it
+        bool startPass(uint32_t address, int port) {
+            if (passOver(address, port)) {
+                passLine[port] = -1;
+                passDone[port] = false;
+                return false;
+            }
+            passLine[port] = getLineAddress(address);
+            passDone[port] = false;
+            return true;
+        }
+
+        // Extend the outstanding miss of a requester
+        void addStall(int port, int cycles) {
+            missCountdown[port] += cycles;
+        }
 
-        // Call this only if you know that a valid line with matching tag exists at that address 
-        CacheLine readLine(uint32_t address);
+        // Advance the write and writeback buffers by one cycle
+        void tick() {
+            writeBuffer.tick();
+            writebackBuffer.tick();
+        }
+
+        // Write dirty words from an upper level into a present line, returns false if the line is absent
+        bool writeBackLine(uint32_t address, const uint32_t *words, int numWords);
+
+        // Replace a line at the set corresponding this address with lineWords words of newData;
+        // a valid victim is returned in evictedLine and its words in evictedData
+        void replace(uint32_t address, const uint32_t *newData, CacheLine &evictedLine, uint32_t *evictedData);
+
+        // Invalidate a line, returns true and the line with its words if it was dirty 
+        bool evictLine(uint32_t address, CacheLine &flushedLine, uint32_t *flushedData);
 
-        // Call this only if you know that a valid line with matching tag exists at that address 
-        void writeBackLine(CacheLine evictedLine);
+        // Coherence: invalidate on a remote write, returns true and the line if it was dirty (M -> I)
+        bool snoopInvalidate(uint32_t address, CacheLine &flushedLine, uint32_t *flushedData);
 
-        // Replace a line at the set corresponding this address
-        void replace(uint32_t address, CacheLine newLine, CacheLine &evictedLine);
+        // Coherence: downgrade on a remote read, returns true and the line if it was dirty (M -> S)
+        bool snoopDowngrade(uint32_t address, CacheLine &flushedLine, uint32_t *flushedData);
 
-        // Invalidate a line
-        void invalidateLine(uint32_t address);
+        const CacheStats &getStats() { return stats; }
+        void resetStats() { stats = CacheStats(); }
+
+        // Print hit/miss and coherence counters
+        void printStats();
 
         // Print a cache line
         void printLine(uint32_t address) {
-            int idx = getIndex(address);
-            int tag = getTag(address);
-
-            for (int w=0; w<assoc; w++) {
-                if (line[idx*assoc+w].valid && line[idx*assoc+w].tag == tag) {
-                    std::cout<< "Valid:" << line[idx*assoc+w].valid << "\n";
-                    std::cout<< "Address:" << line[idx*assoc+w].address << "\n";
-                    std::cout<< "Tag:" << line[idx*assoc+w].tag << "\n";
-                    std::cout<< "Dirty:" << line[idx*assoc+w].dirty << "\n";
-                    std::cout<< "Replacement Bits:" << line[idx*assoc+w].replBits << "\n";
-                    for (int i = 0; i < CACHE_LINE_SIZE/4; i++) {
-                        std::cout<< "DATA[" << i << "]: " << line[idx*assoc+w].data[i] << "\n";
-                    }
-                    return;
-                }
+            int loc = find(address);
+            if (loc < 0) {
+                return;
+            }
+            std::cout<< "Valid:" << line[loc].valid << "\n";
+            std::cout<< "Address:" << line[loc].address << "\n";
+            std::cout<< "Tag:" << line[loc].tag << "\n";
+            std::cout<< "Dirty:" << line[loc].dirty << "\n";
+            for (int i = 0; i < lineWords; i++) {
+                std::cout<< "DATA[" << i << "]: " << (store ? store[line[loc].address/4+i] : data[loc*lineWords+i]) << "\n";
             }
         }
 };
@@ -98,25 +492,216 @@ class Cache {
 class Memory {
     private:
         std::vector<uint32_t> mem;
-        Cache L1 = Cache("L1", 32768, 8, 12);
-        Cache L2 = Cache("L2", 262144, 8, 59);
+        std::vector<Cache> L1I;             // private instruction L1 per core
+        std::vector<Cache> L1D;             // private data L1 per core
+        std::vector<Cache> levels;          // shared levels below the L1s, nearest first; port 4*thread
+                                            // serves data and 4*thread+1 instruction misses, 4*thread+2
+                                            // and 4*thread+3 the page walks of either side
+        Dram dram;                          // timing of mem behind the last level, when enabled
+        std::vector<uint32_t> coreBase;     // per-thread offset into mem (per-thread images)
+        std::mutex lock;                    // serializes the shared levels between host threads
         int opt_level;
+        int contexts;                       // hardware threads per core, sharing its L1s (L1 port = context)
+        std::vector<uint64_t> threadCycle;  // cycles seen by each hardware thread, its core follows the fastest
+        std::vector<uint64_t> coreCycle;    // cycles seen by each core, the shared levels follow the fastest
+        uint64_t sharedCycle;
+        uint64_t accessCycle;               // cycle of the core whose access walks the shared levels
+        bool tagOnly;                       // caches hold no data, mem is always current
+
+        // Translation of a hardware thread's accesses that missed the L1 TLB of their side
+        struct TlbMiss {
+            bool active;
+            bool missed;                    // the access that missed has not completed yet
+            uint32_t vpn;
+            uint32_t pfn;
+            int countdown;                  // L2 TLB lookup cycles left
+            int level;                      // page table level the walk reads next, -1: no walk
+            uint32_t entry;                 // physical address of that page table entry
+            uint64_t start;                 // cycle of the L1 TLB miss
+        };
+        struct WalkStats {
+            uint64_t walks;
+            uint64_t cycles;                // from the L1 TLB miss to the translation, summed over walks
+            uint64_t reads;                 // page table entries read through the caches
+        };
+        VirtualMemoryConfig vm;
+        uint32_t memSize;                   // bytes of program memory; page tables are placed above it
+        int pageBits;
+        int leafBits;                       // a leaf table maps 1 << leafBits pages, the root the rest
+        std::vector<Tlb> ITLB;              // per core, shared by its contexts
+        std::vector<Tlb> DTLB;
+        Tlb L2TLB;                          // shared by all cores
+        std::vector<uint32_t> pageTable;    // physical address of each thread's root table
+        std::vector<int> asid;              // address space of each thread, shared by threads of one region
+        uint32_t tableTop;                  // first free byte for page tables
+        std::vector<TlbMiss> tlbMiss;       // per thread, data side first
+        WalkStats walkStats;
+
+        // Levels are numbered from the core: 0 is the L1 in use, n is levels[n-1], and
+        // levels.size()+1 is memory
+
+        // L1 port of the hardware thread that uses this port of the shared levels: the L1D has one
+        // port per context for data and one per context for each side's page walks
+        int l1Port(int port) {
+            int kind = port % 4;
+            return (kind < 2 ? 0 : kind - 1) * contexts + port/4 % contexts;
+        }
+
+        // Physical address of a virtual one, read from the thread's page table without timing
+        uint32_t walkTable(int thread, uint32_t address);
+
+        // Translate through the L1 TLB of one side, the L2 TLB and page walks through the L1D;
+        // returns false while the translation is under way (stall-on-miss like the caches)
+        bool translate(int thread, bool instr, uint32_t &address);
+
+        // MSI snooping: write back and downgrade/invalidate copies held by other cores
+        void snoop(int core, uint32_t address, bool mem_write, bool instr);
+
+        // Walk the hierarchy from one L1 (instruction or data side of a core); port is its port below L1
+        bool accessL1(Cache &l1, int port, uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, int core, bool instr);
+
+        // Fill the line holding this address into upper (at level lvl) from level src, handling
+        // the victim; port is the requester that waits for it (-1: none). Returns the stall charged
+        int fill(Cache &upper, int lvl, int src, uint32_t address, int port);
+
+        // Remove the copies of a line evicted from level lvl from all levels above it,
+        // merging their dirty words into the evicted data
+        void backInvalidate(int lvl, CacheLine &evictedLine, uint32_t *evictedData, int numWords);
+
+        // Check if a level above lvl holds part of this line
+        bool heldAbove(int lvl, uint32_t address, int numWords);
+
+        // Handle the victim of c (at level lvl) as the inclusion policies of c and the level
+        // below require; returns the cycles a refill waits for its writeback
+        int evict(Cache &c, int lvl, CacheLine &evictedLine, uint32_t *evictedData);
+
+        // Insert a line evicted from the level above into the exclusive level lvl
+        void spill(int lvl, CacheLine &victim, const uint32_t *words);
+
+        // Send a store that leaves level lvl (write-through or bypassing a miss) down the hierarchy
+        void writeThrough(int lvl, uint32_t address, uint32_t write_data);
+
+        // Write dirty words that leave level lvl into the first level below holding them, or memory
+        void writeBack(int lvl, uint32_t address, const uint32_t *words, int numWords);
     public:
-        Memory() {
-            mem.resize(2097152, 0);
+        // num_cores cores of contexts hardware threads each; threads are numbered core by core
+        Memory(int num_cores = 1, const HierarchyConfig &config = HierarchyConfig(), int num_contexts = 1) :
+            L2TLB(config.vm.l2tlb) {
+            memSize = 2097152*4;
+            for (int c = 0; c < num_cores; c++) {
+                std::string suffix = num_cores > 1 ? "." + std::to_string(c) : "";
+                CacheConfig l1i = config.l1i;
+                CacheConfig l1d = config.l1d;
+                l1i.name += suffix;
+                l1d.name += suffix;
+                L1I.push_back(Cache(l1i));
+                L1D.push_back(Cache(l1d));
+                L1I[c].setPorts(num_contexts);
+                L1D[c].setPorts(3*num_contexts);
+            }
+            contexts = num_contexts;
+            int num_threads = num_cores*contexts;
+            for (int k = 0; k < (int)config.levels.size(); k++) {
+                levels.push_back(Cache(config.levels[k]));
+                levels[k].setPorts(4*num_threads);
+            }
+            if (config.dram.banks > 0) {
+                dram.configure(config.dram, 4*num_threads);
+            }
+
+            // Page tables of all threads fit above program memory: a root table each and leaf
+            // tables for every page of memory
+            vm = config.vm;
+            pageBits = (int)log2(vm.pageSize);
+            leafBits = std::min(pageBits-2, 32-pageBits);
+            uint32_t leafTables = ((memSize >> pageBits) + (1u << leafBits) - 1) >> leafBits;
+            uint32_t tableBytes = vm.enabled ? num_threads*4*((1u << (32-pageBits-leafBits)) + (leafTables << leafBits)) : 0;
+            mem.resize((memSize + tableBytes)/4, 0);
+            tableTop = memSize;
+            for (int c = 0; vm.enabled && c < num_cores; c++) {
+                std::string suffix = num_cores > 1 ? "." + std::to_string(c) : "";
+                TlbConfig itlb = vm.itlb;
+                TlbConfig dtlb = vm.dtlb;
+                itlb.name += suffix;
+                dtlb.name += suffix;
+                ITLB.push_back(Tlb(itlb));
+                DTLB.push_back(Tlb(dtlb));
+            }
+            pageTable.resize(num_threads, 0);
+            asid.resize(num_threads, 0);
+            tlbMiss.resize(2*num_threads, TlbMiss());
+            walkStats = WalkStats();
+            coreBase.resize(num_threads, 0);
+            threadCycle.resize(num_threads, 0);
+            coreCycle.resize(num_cores, 0);
+            sharedCycle = 0;
+            accessCycle = 0;
+            tagOnly = config.tagOnly;
+            if (tagOnly) {
+                for (int c = 0; c < num_cores; c++) {
+                    L1I[c].setBackingStore(mem.data());
+                    L1D[c].setBackingStore(mem.data());
+                }
+                for (int k = 0; k < (int)levels.size(); k++) {
+                    levels[k].setBackingStore(mem.data());
+                }
+            }
+            // refills are timed in the cycles of the core that waits for them
+            for (int c = 0; c < num_cores; c++) {
+                L1I[c].setClock(&coreCycle[c]);
+                L1D[c].setClock(&coreCycle[c]);
+            }
+            for (int k = 0; k < (int)levels.size(); k++) {
+                levels[k].setClock(&accessCycle);
+            }
             opt_level = 0;
         }
         void setOptLevel(int level) {
             opt_level = level;
         }
+        int numCores() { return L1D.size(); }
+        int numContexts() { return contexts; }
+        uint32_t size() { return memSize; }
+
+        // Advance the write and writeback buffers seen by a hardware thread by one cycle
+        void tick(int thread = 0);
+
+        // Give a hardware thread its own region of memory; all of its addresses are offset by base
+        void setCoreBase(int thread, uint32_t base) {
+            coreBase[thread] = base;
+        }
+
+        // With virtual memory, build the page table of a hardware thread: the pages from 0 to the
+        // end of memory map to its region, so translation places accesses where setCoreBase()
+        // does. Threads of one region share one table and address space.
+        void mapPages(int thread);
+        bool virtualMemory() { return vm.enabled; }
         // address is the adress which needs to be read or written from
         // read_data the variable into which data is read, it is passed by reference
         // write_data is the data which is written into the memory address provided
         // mem_read specifies whether memory should be read or not
         // mem_write specifies whether memory whould be written to or not
+        // thread is the requesting hardware thread (the core without contexts), which selects
+        // the private L1D of its core
         // returns false if there is a cache miss (O1 and above) 
         // -- currently follows stall-on-miss model, so call every cycle until you see a hit
-        bool access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write);
+        bool access(uint32_t address, uint32_t &read_data, uint32_t write_data, bool mem_read, bool mem_write, int thread = 0);
+
+        // Instruction fetch through the L1I of a core, same stall-on-miss model as access()
+        bool fetch(uint32_t address, uint32_t &instruction, int thread = 0);
+
+        // Counters of the L1s of a hardware thread's core and of shared level k (0 is the
+        // nearest), for sampling
+        const CacheStats &getL1IStats(int thread) { return L1I[thread/contexts].getStats(); }
+        const CacheStats &getL1DStats(int thread) { return L1D[thread/contexts].getStats(); }
+        const CacheStats &getLevelStats(int k) { return levels[k].getStats(); }
+        int numLevels() { return levels.size(); }
+
+        // Print per-level cache statistics
+        void printStats();
+
+        // Start counting afresh, e.g. at the beginning of the region of interest
+        void resetStats();
 
         // given a starting address and number of words from that starting address
         // this function prints int values at the memory
@@ -0,0 +1,143 @@
+#ifndef MEMTRACE
+#define MEMTRACE
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+
+// One completed data access of the processor
+struct MemoryTraceRecord {
+    uint32_t pc;
+    uint32_t address;
+    bool write;
+    int size;                   // bytes: 1, 2 or 4
+};
+
+/* Memory traces are gzip streams of variable-length records: a flags byte (bit 0 write, bits
+   1-2 log2 of the size, bit 3 set when the pc did not follow the previous one by 4), then the
+   zigzag varint pc delta if bit 3 is set, then the zigzag varint address delta. Deltas are
+   against the previous record, so loops over arrays encode in a few bytes before compression. */
+static const char MEMTRACE_MAGIC[8] = {'M', 'I', 'P', 'S', 'T', 'R', 'C', '1'};
+
+class MemoryTraceWriter {
+    private:
+        gzFile file;
+        unsigned char buffer[65536];
+        int used;
+        uint32_t lastPC;
+        uint32_t lastAddress;
+        uint64_t records;
+
+        void varint(int32_t delta) {
+            uint32_t v = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+            while (v >= 0x80) {
+                buffer[used++] = (v & 0x7f) | 0x80;
+                v >>= 7;
+            }
+            buffer[used++] = v;
+        }
+        void flush() {
+            gzwrite(file, buffer, used);
+            used = 0;
+        }
+    public:
+        MemoryTraceWriter() : file(nullptr), used(0), lastPC(0), lastAddress(0), records(0) {}
+        ~MemoryTraceWriter() { close(); }
+
+        bool open(const char *path) {
+            file = gzopen(path, "wb");
+            if (!file) {
+                return false;
+            }
+            gzwrite(file, MEMTRACE_MAGIC, sizeof(MEMTRACE_MAGIC));
+            return true;
+        }
+
+        void record(uint32_t pc, uint32_t address, bool write, int size) {
+            if (used > (int)sizeof(buffer) - 16) {
+                flush();
+            }
+            bool jump = pc != lastPC + 4;
+            buffer[used++] = write | (size == 4 ? 2 : size == 2 ? 1 : 0) << 1 | jump << 3;
+            if (jump) {
+                varint(pc - lastPC);
+            }
+            varint(address - lastAddress);
+            lastPC = pc;
+            lastAddress = address;
+            records++;
+        }
+
+        uint64_t count() { return records; }
+
+        void close() {
+            if (file) {
+                flush();
+                gzclose(file);
+                file = nullptr;
+            }
+        }
+};
+
+// Streams the records of a trace back without holding the file in memory
+class MemoryTraceReader {
+    private:
+        gzFile file;
+        uint32_t lastPC;
+        uint32_t lastAddress;
+
+        bool varint(int32_t &delta) {
+            uint32_t v = 0;
+            for (int shift = 0; shift < 35; shift += 7) {
+                int c = gzgetc(file);
+                if (c < 0) {
+                    return false;
+                }
+                v |= (uint32_t)(c & 0x7f) << shift;
+                if (!(c & 0x80)) {
+                    delta = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+                    return true;
+                }
+            }
+            return false;
+        }
+    public:
+        MemoryTraceReader() : file(nullptr), lastPC(0), lastAddress(0) {}
+        ~MemoryTraceReader() {
+            if (file) {
+                gzclose(file);
+            }
+        }
+
+        bool open(const char *path) {
+            file = gzopen(path, "rb");
+            if (!file) {
+                return false;
+            }
+            gzbuffer(file, 1 << 17);
+            char magic[sizeof(MEMTRACE_MAGIC)];
+            return gzread(file, magic, sizeof(magic)) == sizeof(magic) && !memcmp(magic, MEMTRACE_MAGIC, sizeof(magic));
+        }
+
+        // False at the end of the trace (or on a truncated record)
+        bool next(MemoryTraceRecord &r) {
+            int flags = gzgetc(file);
+            if (flags < 0) {
+                return false;
+            }
+            int32_t delta = 4;
+            if ((flags & 8) && !varint(delta)) {
+                return false;
+            }
+            lastPC += delta;
+            if (!varint(delta)) {
+                return false;
+            }
+            lastAddress += delta;
+            r.pc = lastPC;
+            r.address = lastAddress;
+            r.write = flags & 1;
+            r.size = 1 << ((flags >> 1) & 3);
+            return true;
+        }
+};
+#endif
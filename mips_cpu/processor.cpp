@@ -1,6 +1,7 @@
 #include <cstdint>
 #include <iostream>
 #include "processor.h"
+#include "hostprof.h"
 using namespace std;
 #ifdef ENABLE_DEBUG
 #define DEBUG(x) x
@@ -27,36 +28,58 @@ void Processor::initialize(int level) {
                .byte = 0,
                .ALU_src = 0,
                .reg_write = 0,
-               .zero_extend = 0};
+               .zero_extend = 0,
+               .mul_div = 0,
+               .move_hilo = 0,
+               .load_signed = 0,
+               .marker = MARKER_NONE};
    
     opt_level = level;
 }
 
-void Processor::advance() {
-    switch (opt_level) {
-        case 0: single_cycle_processor_advance();
-                break;
-        case 1: pipelined_processor_advance();
-                break;
-        default: break;
+int Processor::instructionCount() {
+    int count = front_end.enabled() ? front_end.size() : 0;
+    switch (getTimingModel()) {
+        case FIVE_STAGE:
+            return count + if_id.ops + id_ex.ops;
+        case SCOREBOARD:
+            return count + if_id.ops;
+        case CONFIGURABLE_PIPELINE:
+            for (int s = 0; s < pipeline.fetch + pipeline.decode; s++) {
+                count += stages[s].valid;
+            }
+            return count;
+        default:
+            return 0;
     }
 }
 
+void Processor::startDetailed() {
+    memset(&if_id, 0, sizeof(IF_ID_reg));
+    memset(&id_ex, 0, sizeof(ID_EX_reg));
+    memset(&ex_mem, 0, sizeof(EX_MEM_reg));
+    memset(&mem_wb, 0, sizeof(MEM_WB_reg));
+    for (PipeSlot &slot : stages) {
+        slot.valid = false;
+    }
+    issued.clear();
+    current_pc = regfile.pc;
+    fetch_pc = regfile.pc;
+    if (front_end.enabled()) {
+        front_end.redirect(regfile.pc);
+        front_end.resetStats();
+    }
+    value_predictor.resetStats();
+    memset(fused, 0, sizeof(fused));
+    marker = MARKER_NONE;
+    stats = CoreStats();
+}
 
-
-void Processor::single_cycle_processor_advance() {
-    // fetch
-    uint32_t instruction;
-    memory->access(regfile.pc, instruction, 0, 1, 0);
-    // increment pc
-    std::cout << "PC: 0x" << std::hex << regfile.pc << std::dec << std::endl;
-    regfile.pc += 4;
-    
-    // decode into contol signals
+// Print the instruction the single-cycle model is about to execute at regfile.pc
+void Processor::trace_instruction(uint32_t instruction) {
+    control_t control;
     control.decode(instruction);
-    DEBUG(control.print());
-
-
+    std::cout << "PC: 0x" << std::hex << regfile.pc << std::dec << std::endl;
     std::cout << "Control signals:" << std::endl;
     std::cout << "  ALU_op: " << control.ALU_op << std::endl;
     std::cout << "  reg_dest: " << control.reg_dest << std::endl;
@@ -75,6 +98,48 @@ void Processor::single_cycle_processor_advance() {
     std::cout << "  halfword: " << control.halfword << std::endl;
     std::cout << "  zero_extend: " << control.zero_extend << std::endl;
 
+    int rs = (instruction >> 21) & 0x1f;
+    int rt = (instruction >> 16) & 0x1f;
+    int rd = (instruction >> 11) & 0x1f;
+    int shamt = (instruction >> 6) & 0x1f;
+    int funct = instruction & 0x3f;
+    uint32_t imm = (instruction & 0xffff);
+    int addr = instruction & 0x3ffffff;
+    std::cout << "rs: " << rs << " [R" << rs << "]" << std::endl;
+    std::cout << "rt: " << rt << " [R" << rt << "]" << std::endl;
+    std::cout << "rd: " << rd << " [R" << rd << "]" << std::endl;
+    std::cout << "shamt: " << shamt << std::endl;
+    std::cout << "funct: " << funct << " (0x" << std::hex << funct << std::dec << ")" << std::endl;
+    std::cout << "immediate: " << std::dec << (int16_t)imm << " (0x" << std::hex << imm << std::dec << ")" << std::endl;
+    std::cout << "address: 0x" << std::hex << addr << std::dec << std::endl;
+}
+
+template <class Trace>
+void Processor::single_cycle_processor_advance() {
+    HOST_PROFILE_STAGES(HOST_FETCH);
+    // a hardware context only executes in the cycles it has the fetch slot
+    if (!fetch_granted) {
+        return;
+    }
+    // fetch
+    uint32_t instruction;
+    memory->fetch(regfile.pc, instruction, core_id);
+    if (Trace::enabled) {
+        HOST_PROFILE_SCOPE(HOST_OUTPUT);
+        trace_instruction(instruction);
+    }
+    // increment pc
+    regfile.pc += 4;
+    stats.retired++;
+    
+    // decode into contol signals
+    HOST_PROFILE_STAGE(HOST_DECODE);
+    control.decode(instruction);
+    DEBUG(control.print());
+    if (roi && control.marker) {
+        marker = control.marker;
+    }
+
     // extract rs, rt, rd, imm, funct 
     int opcode = (instruction >> 26) & 0x3f;
     int rs = (instruction >> 21) & 0x1f;
@@ -87,13 +152,6 @@ void Processor::single_cycle_processor_advance() {
     // Variables to read data into
     uint32_t read_data_1 = 0;
     uint32_t read_data_2 = 0;
-std::cout << "rs: " << rs << " [R" << rs << "]" << std::endl;
-std::cout << "rt: " << rt << " [R" << rt << "]" << std::endl;
-std::cout << "rd: " << rd << " [R" << rd << "]" << std::endl;
-std::cout << "shamt: " << shamt << std::endl;
-std::cout << "funct: " << funct << " (0x" << std::hex << funct << std::dec << ")" << std::endl;
-std::cout << "immediate: " << std::dec << (int16_t)imm << " (0x" << std::hex << imm << std::dec << ")" << std::endl;
-std::cout << "address: 0x" << std::hex << addr << std::dec << std::endl;
 
     // Read from reg file
     regfile.access(rs, rt, read_data_1, read_data_2, 0, 0, 0);
@@ -112,33 +170,47 @@ std::cout << "address: 0x" << std::hex << addr << std::dec << std::endl;
     uint32_t operand_2 = control.ALU_src ? imm : read_data_2;
     uint32_t alu_zero = 0;
 
+    HOST_PROFILE_STAGE(HOST_EXECUTE);
     uint32_t alu_result = alu.execute(operand_1, operand_2, alu_zero);
+    if (control.mul_div) {
+        alu.execute_hilo(funct, read_data_1, read_data_2, regfile.hi, regfile.lo);
+    }
+    if (control.move_hilo) {
+        alu_result = funct == 0x10 ? regfile.hi : regfile.lo;
+    }
     uint32_t read_data_mem = 0;
     uint32_t write_data_mem = 0;
 
     // Memory
+    HOST_PROFILE_STAGE(HOST_MEMORY_STAGE);
     // First read no matter whether it is a load or a store
-    memory->access(alu_result, read_data_mem, 0, control.mem_read | control.mem_write, 0);
-    // Stores: sb or sh mask and preserve original leftmost bits
-    write_data_mem = control.halfword ? (read_data_mem & 0xffff0000) | (read_data_2 & 0xffff) : 
-                    control.byte ? (read_data_mem & 0xffffff00) | (read_data_2 & 0xff): read_data_2;
+    memory->access(alu_result, read_data_mem, 0, control.mem_read | control.mem_write, 0, core_id);
+    // Stores: sb or sh replace their byte or halfword and preserve the rest of the word
+    write_data_mem = store_lane(read_data_mem, read_data_2, alu_result, control.halfword, control.byte);
     // Write to memory only if mem_write is 1, i.e store
-    memory->access(alu_result, read_data_mem, write_data_mem, control.mem_read, control.mem_write);
-    // Loads: lbu or lhu modify read data by masking
-    read_data_mem &= control.halfword ? 0xffff : control.byte ? 0xff : 0xffffffff;
+    memory->access(alu_result, read_data_mem, write_data_mem, control.mem_read, control.mem_write, core_id);
+    if (control.mem_read || control.mem_write) {
+        record_access(regfile.pc - 4, alu_result, control.mem_write, control.halfword, control.byte);
+    }
+    // Loads: lbu or lhu select their byte or halfword of the word, lb and lh also sign-extend
+    read_data_mem = load_lane(read_data_mem, alu_result, control.halfword, control.byte, control.load_signed);
 
-    int write_reg = control.link ? 31 : control.reg_dest ? rd : rt;
+    int write_reg = control.link && !control.reg_dest ? 31 : control.reg_dest ? rd : rt;
 
-    uint32_t write_data = control.link ? regfile.pc+8 : control.mem_to_reg ? read_data_mem : alu_result;  
+    // jal/jalr link to the instruction address + 8, as in the pipelined model (pc is already advanced)
+    uint32_t write_data = control.link ? regfile.pc+4 : control.mem_to_reg ? read_data_mem : alu_result;  
 
     // Write Back
+    HOST_PROFILE_STAGE(HOST_WRITEBACK);
     regfile.access(0, 0, read_data_2, read_data_2, write_reg, control.reg_write, write_data);
     
     // Update PC
     regfile.pc += (control.branch && !control.bne && alu_zero) || (control.bne && !alu_zero) ? imm << 2 : 0; 
-    regfile.pc = control.jump_reg ? read_data_1 : control.jump ? (regfile.pc & 0xf0000000) & (addr << 2): regfile.pc;
+    regfile.pc = control.jump_reg ? read_data_1 : control.jump ? (regfile.pc & 0xf0000000) | (addr << 2): regfile.pc;
 }
 
+template void Processor::single_cycle_processor_advance<CycleTrace>();
+template void Processor::single_cycle_processor_advance<NoTrace>();
 
 
 
@@ -147,95 +219,65 @@ std::cout << "address: 0x" << std::hex << addr << std::dec << std::endl;
 
 
 
-struct IF_ID_reg {
-    uint32_t instruction;
-    uint32_t pc;
-    
-};
-
-struct ID_EX_reg {
-    // Data read from registers
-    uint32_t read_data_1;
-    uint32_t read_data_2;
-    
-    // Instruction fields decoded in ID
-    int opcode;
-    int rs;
-    int rt;
-    int rd;
-    int shamt;
-    int funct;
-    uint32_t imm;
-    
-    // Control signals
-    bool ALU_src;
-    bool reg_dest;
-    unsigned ALU_op : 2;
-    bool shift;
-    bool mem_read;
-    bool mem_write;
-    bool halfword;
-    bool byte;
-    bool reg_write;
-    bool mem_to_reg;
-
-    // Branch/Jump control
-    bool branch;
-    bool bne;
-    bool jump;
-    bool jump_reg;
-    bool link;
-    uint32_t branch_target;
-    uint32_t jump_target;
-    uint32_t pc;
-};
-
-struct EX_MEM_reg {
-    uint32_t alu_result;
-    uint32_t write_data;
-    int write_reg;
-    
-    bool mem_read;
-    bool mem_write;
-    bool halfword;
-    bool byte;
-    bool reg_write;
-    bool mem_to_reg;
-    
-    // Branch results
-    bool branch_taken;
-    uint32_t branch_target;
-    bool jump;
-    uint32_t jump_target;
-    uint32_t pc;
-    bool link;
-};
-
-struct MEM_WB_reg {
-    uint32_t read_data;
-    uint32_t alu_result;
-    int write_reg;
-    
-    bool reg_write;
-    bool mem_to_reg;
-    uint32_t pc;
-    bool link;
-};
 
+// Kind of the fused op decode can make of two consecutive instructions, FUSE_NONE if the pair
+// is no supported idiom. The first result must be dead or consumed by the second alone, so
+// the fused op still writes a single register.
+static int fusion_kind(uint32_t first, uint32_t second) {
+    int op1 = first >> 26, op2 = second >> 26;
+    int rt1 = (first >> 16) & 0x1f, rd1 = (first >> 11) & 0x1f;
+    int rs2 = (second >> 21) & 0x1f, rt2 = (second >> 16) & 0x1f;
+    bool load2 = op2 == 0x23 || op2 == 0x20 || op2 == 0x21 || op2 == 0x24 || op2 == 0x25;
+    if (op1 == 0xf && rt1 != 0 && (op2 == 0xd || op2 == 0x9) && rs2 == rt1 && rt2 == rt1) {
+        return FUSE_CONSTANT;
+    }
+    if ((op1 == 0xf || op1 == 0x9) && rt1 != 0 && load2 && rs2 == rt1 && rt2 == rt1) {
+        return FUSE_ADDRESS;
+    }
+    bool set_r = op1 == 0 && ((first & 0x3f) == 0x2a || (first & 0x3f) == 0x2b);
+    int dest = set_r ? rd1 : rt1;
+    if ((set_r || op1 == 0xa || op1 == 0xb) && dest != 0 && (op2 == 0x4 || op2 == 0x5) && rs2 == dest && rt2 == 0) {
+        return FUSE_COMPARE_BRANCH;
+    }
+    return FUSE_NONE;
+}
 
+// A branch or jump at pc resolved: without a front end fetch always continued sequentially, so
+// every taken branch redirects it. The front end may have followed a loop buffer prediction
+// instead, and is corrected only when that prediction was wrong.
+bool Processor::branch_mispredicted(uint32_t pc, uint32_t predicted, bool taken, bool jump_reg, uint32_t target, uint32_t &next_pc) {
+    if (!front_end.enabled()) {
+        if (taken) {
+            next_pc = target;
+            stats.mispredicts++;
+        }
+        return taken;
+    }
+    if (taken && !jump_reg) {
+        front_end.train(pc, target);
+    }
+    next_pc = taken ? target : pc + 4;
+    if (next_pc == predicted) {
+        return false;
+    }
+    front_end.redirect(next_pc);
+    stats.mispredicts++;
+    return true;
+}
 
 void Processor::pipelined_processor_advance() {
-    static IF_ID_reg if_id;
-    static ID_EX_reg id_ex;
-    static EX_MEM_reg ex_mem;
-    static MEM_WB_reg mem_wb;
-    static uint32_t current_pc = 0;
-
-    
+    HOST_PROFILE_STAGES(HOST_FETCH);
+    cycle++;
     bool flush = false;
     uint32_t new_pc = current_pc + 4;  // Default next PC
 
+    // The front end fetches ahead every cycle it has the fetch slot, whatever happens behind it
+    if (front_end.enabled() && (fetch_granted || front_end.missPending())) {
+        front_end.tick();
+    }
+
     // WB Stage
+    HOST_PROFILE_STAGE(HOST_WRITEBACK);
     uint32_t write_data = 0;
     if (mem_wb.reg_write) {
         uint32_t read_data_1, read_data_2;
@@ -246,42 +288,67 @@ void Processor::pipelined_processor_advance() {
         regfile.access(0, 0, read_data_1, read_data_2, mem_wb.write_reg, true, write_data);
     }
     regfile.pc = mem_wb.pc;  // Update regfile PC to match WB stage PC
+    if (roi && mem_wb.ops && mem_wb.marker) {
+        marker = mem_wb.marker;
+    }
+    stats.retired += mem_wb.ops;
+    mem_wb.ops = 0;         // retired once, even if MEM holds it here for several cycles
 
 
     // MEM Stage
+    HOST_PROFILE_STAGE(HOST_MEMORY_STAGE);
     uint32_t read_data_mem = 0;
     uint32_t write_data_mem = 0;
     if (ex_mem.mem_read|ex_mem.mem_write) {
         if(ex_mem.mem_read){
-            if (!memory->access(ex_mem.alu_result, read_data_mem, ex_mem.write_data, ex_mem.mem_read|ex_mem.mem_write, ex_mem.mem_write)){
+            if (!memory->access(ex_mem.alu_result, read_data_mem, ex_mem.write_data, ex_mem.mem_read|ex_mem.mem_write, ex_mem.mem_write, core_id)){
+                stats.memoryStalls++;
                 return;
             }   
         }
         if(ex_mem.mem_write){
             if (ex_mem.halfword || ex_mem.byte){
-                if (!memory->access(ex_mem.alu_result, read_data_mem, ex_mem.write_data, ex_mem.mem_read|ex_mem.mem_write, ex_mem.mem_write)){
+                if (!memory->access(ex_mem.alu_result, read_data_mem, ex_mem.write_data, ex_mem.mem_read|ex_mem.mem_write, ex_mem.mem_write, core_id)){
+                    stats.memoryStalls++;
                     return;
                 }
-                write_data_mem = ex_mem.halfword ? (read_data_mem & 0xffff0000) | (ex_mem.write_data & 0xffff) : 
-            ex_mem.byte ? (read_data_mem & 0xffffff00) | (ex_mem.write_data & 0xff): ex_mem.write_data;
+                write_data_mem = store_lane(read_data_mem, ex_mem.write_data, ex_mem.alu_result, ex_mem.halfword, ex_mem.byte);
             }else{
                 write_data_mem = ex_mem.write_data;
             }
-            if (!memory->access(ex_mem.alu_result, read_data_mem, write_data_mem, ex_mem.mem_read, ex_mem.mem_write)){
+            if (!memory->access(ex_mem.alu_result, read_data_mem, write_data_mem, ex_mem.mem_read, ex_mem.mem_write, core_id)){
+                stats.memoryStalls++;
                 return;
             }
         }
-        read_data_mem &= ex_mem.halfword ? 0xffff : ex_mem.byte ? 0xff : 0xffffffff;
+        record_access(ex_mem.pc, ex_mem.alu_result, ex_mem.mem_write, ex_mem.halfword, ex_mem.byte);
+        read_data_mem = load_lane(read_data_mem, ex_mem.alu_result, ex_mem.halfword, ex_mem.byte, ex_mem.load_signed);
+    }
+
+    // The loaded value verifies the prediction dependents in EX are using this cycle
+    bool value_mispredicted = false;
+    if (ex_mem.mem_read && value_predictor.enabled()) {
+        value_predictor.update(ex_mem.pc, read_data_mem, ex_mem.predicted, ex_mem.predicted_value);
+        value_mispredicted = ex_mem.predicted && read_data_mem != ex_mem.predicted_value;
     }
  
 
+    HOST_PROFILE_STAGE(HOST_EXECUTE);
     bool stall = false;
     // Check for hazards
+    bool load_use = false;
     if (ex_mem.mem_read && ex_mem.write_reg != 0) {
         if ((id_ex.rs == ex_mem.write_reg) || (id_ex.rt == ex_mem.write_reg && (id_ex.branch || id_ex.mem_write || id_ex.opcode == 0) ) ) {
-            stall = true;
+            load_use = true;
+            stall = !ex_mem.predicted;
         }
     }
+
+    // Multi-cycle units: mfhi/mflo wait for HI/LO (data hazard), a divide waits for the
+    // divider to finish the previous one (structural hazard); the multiplier is pipelined
+    if ((id_ex.move_hilo && cycle < hilo_ready) || (id_ex.mul_div && id_ex.funct >= 0x1a && cycle < div_free)) {
+        stall = true;
+    }
         
     
     // EX Stage
@@ -300,13 +367,13 @@ void Processor::pipelined_processor_advance() {
         }
     }
 
-    // Forward from EX/MEM (Previous stage)
+    // Forward from EX/MEM (Previous stage), a predicted load forwards its predicted value
     if (ex_mem.reg_write && ex_mem.write_reg != 0) {
         if (id_ex.rs == ex_mem.write_reg) {
-            forward_data1 = ex_mem.alu_result;
+            forward_data1 = ex_mem.predicted ? ex_mem.predicted_value : ex_mem.alu_result;
         }
         if (id_ex.rt == ex_mem.write_reg) {
-            forward_data2 = ex_mem.alu_result;
+            forward_data2 = ex_mem.predicted ? ex_mem.predicted_value : ex_mem.alu_result;
         }
     }
 
@@ -316,21 +383,13 @@ void Processor::pipelined_processor_advance() {
     
     alu.generate_control_inputs(id_ex.ALU_op, id_ex.funct, id_ex.opcode);
     uint32_t ex_result = alu.execute(operand_1, operand_2, alu_zero);
+    if (id_ex.move_hilo) {
+        ex_result = id_ex.funct == 0x10 ? regfile.hi : regfile.lo;
+    }
     
     // Branch/Jump decision in EX stage
     bool actual_branch_taken = (id_ex.branch && !id_ex.bne && alu_zero) || 
                                 (id_ex.bne && !alu_zero);
-    
-    if (actual_branch_taken || id_ex.jump || id_ex.jump_reg) {
-        flush = true;
-        if (id_ex.jump_reg) {
-            new_pc = forward_data1;
-        } else if (id_ex.jump) {
-            new_pc = id_ex.jump_target;
-        } else {
-            new_pc = id_ex.branch_target;
-        }
-    }
 
 
     // Update MEM/WB
@@ -341,19 +400,54 @@ void Processor::pipelined_processor_advance() {
     mem_wb.mem_to_reg = ex_mem.mem_to_reg;
     mem_wb.pc = ex_mem.pc;  
     mem_wb.link = ex_mem.link;
+    mem_wb.ops = ex_mem.ops;
+    mem_wb.marker = ex_mem.marker;
 
 
     if (stall){
+        stats.interlocks++;
         memset(&ex_mem, 0, sizeof(EX_MEM_reg));
         return;
     }
 
+    // The instruction in EX computed with a mispredicted load value: squash it and everything
+    // younger, and fetch it again; it gets the loaded value from MEM/WB next time
+    if (value_mispredicted && load_use) {
+        value_predictor.countReplay();
+        uint32_t replay_pc = id_ex.pc;
+        memset(&ex_mem, 0, sizeof(EX_MEM_reg));
+        memset(&id_ex, 0, sizeof(ID_EX_reg));
+        memset(&if_id, 0, sizeof(IF_ID_reg));
+        if (front_end.enabled()) {
+            front_end.redirect(replay_pc);
+        }
+        current_pc = replay_pc;
+        return;
+    }
+
+    // A stalled branch is resolved once its operands are available
+    if (id_ex.branch || id_ex.jump) {
+        uint32_t target = id_ex.jump_reg ? forward_data1 : id_ex.jump ? id_ex.jump_target : id_ex.branch_target;
+        uint32_t branch_pc = id_ex.fused == FUSE_COMPARE_BRANCH ? id_ex.pc + 4 : id_ex.pc;
+        flush = branch_mispredicted(branch_pc, id_ex.next_pc, actual_branch_taken || id_ex.jump, id_ex.jump_reg, target, new_pc);
+    }
+
+    // HI/LO are written when the mult/div leaves EX; results become visible in program order
+    if (id_ex.mul_div) {
+        alu.execute_hilo(id_ex.funct, forward_data1, forward_data2, regfile.hi, regfile.lo);
+        uint64_t latency = id_ex.funct >= 0x1a ? div_latency : mul_latency;
+        hilo_ready = max(hilo_ready, cycle + latency);
+        if (id_ex.funct >= 0x1a) {
+            div_free = cycle + div_latency;
+        }
+    }
+
         
 
     // EX/MEM ← ID/EX
     ex_mem.alu_result = ex_result;
     ex_mem.write_data = forward_data2;
-    ex_mem.write_reg = id_ex.link? 31: id_ex.reg_dest ? id_ex.rd : id_ex.rt;
+    ex_mem.write_reg = id_ex.link && !id_ex.reg_dest ? 31 : id_ex.reg_dest ? id_ex.rd : id_ex.rt;
     ex_mem.mem_read = id_ex.mem_read;
     ex_mem.mem_write = id_ex.mem_write;
     ex_mem.reg_write = id_ex.reg_write;
@@ -365,29 +459,50 @@ void Processor::pipelined_processor_advance() {
     ex_mem.pc = id_ex.pc; 
     ex_mem.byte = id_ex.byte;
     ex_mem.halfword = id_ex.halfword;
+    ex_mem.load_signed = id_ex.load_signed;
     ex_mem.link = id_ex.link;
+    ex_mem.ops = id_ex.ops;
+    ex_mem.marker = id_ex.marker;
+    fused[id_ex.fused]++;
+    ex_mem.predicted = id_ex.mem_read && value_predictor.enabled() && value_predictor.predict(id_ex.pc, ex_mem.predicted_value);
 
     if (!flush) {
         // ID/EX ← IF/ID
+        HOST_PROFILE_STAGE(HOST_DECODE);
+        // A fused constant or address pair executes as its second instruction with the
+        // first one folded into the operands
+        uint32_t instruction = if_id.fused == FUSE_CONSTANT || if_id.fused == FUSE_ADDRESS ? if_id.second : if_id.instruction;
         control_t control;
-        control.decode(if_id.instruction);
+        control.decode(instruction);
         
-        id_ex.opcode = (if_id.instruction >> 26) & 0x3f;
-        id_ex.rs = (if_id.instruction >> 21) & 0x1f;
-        id_ex.rt = (if_id.instruction >> 16) & 0x1f;
-        id_ex.rd = (if_id.instruction >> 11) & 0x1f;
-        id_ex.shamt = (if_id.instruction >> 6) & 0x1f;
-        id_ex.funct = if_id.instruction & 0x3f;
-        id_ex.imm = (if_id.instruction & 0xffff);
+        id_ex.opcode = (instruction >> 26) & 0x3f;
+        id_ex.rs = (instruction >> 21) & 0x1f;
+        id_ex.rt = (instruction >> 16) & 0x1f;
+        id_ex.rd = (instruction >> 11) & 0x1f;
+        id_ex.shamt = (instruction >> 6) & 0x1f;
+        id_ex.funct = instruction & 0x3f;
+        id_ex.imm = (instruction & 0xffff);
         id_ex.pc = if_id.pc; 
+        id_ex.next_pc = if_id.next_pc;
+        id_ex.fused = if_id.fused;
+        id_ex.ops = if_id.ops;
+        id_ex.marker = control.marker;
         
         id_ex.imm = control.zero_extend ? id_ex.imm : (id_ex.imm >> 15) ? 0xffff0000 | id_ex.imm : id_ex.imm;
         
         // Calculate jump and branch targets in decode stage
-        uint32_t jump_addr = if_id.instruction & 0x03FFFFFF;  
+        uint32_t jump_addr = instruction & 0x03FFFFFF;  
         id_ex.jump_target = (if_id.pc & 0xF0000000) | (jump_addr << 2);  
         id_ex.branch_target = if_id.pc + 4 + (id_ex.imm << 2); 
 
+        // lui/addiu ahead of the fused op: read its source instead and add its immediate
+        if (if_id.fused == FUSE_CONSTANT || if_id.fused == FUSE_ADDRESS) {
+            bool lui = (if_id.instruction >> 26) == 0xf;
+            uint32_t imm = if_id.instruction & 0xffff;
+            id_ex.rs = lui ? 0 : (if_id.instruction >> 21) & 0x1f;
+            id_ex.imm += lui ? imm << 16 : (imm >> 15) ? 0xffff0000 | imm : imm;
+        }
+
         
         // Access register file
         regfile.access(id_ex.rs, id_ex.rt, id_ex.read_data_1, id_ex.read_data_2, 0, false, 0);
@@ -423,6 +538,9 @@ void Processor::pipelined_processor_advance() {
         id_ex.mem_to_reg = control.mem_to_reg;
         id_ex.halfword = control.halfword;
         id_ex.byte = control.byte;
+        id_ex.load_signed = control.load_signed;
+        id_ex.mul_div = control.mul_div;
+        id_ex.move_hilo = control.move_hilo;
         
         // Branch/Jump control
         id_ex.branch = control.branch;
@@ -430,21 +548,479 @@ void Processor::pipelined_processor_advance() {
         id_ex.jump = control.jump;
         id_ex.jump_reg = control.jump_reg;
         id_ex.link = control.link;
+
+        // Fused compare-and-branch: the set-less-than result decides the branch that follows it
+        if (if_id.fused == FUSE_COMPARE_BRANCH) {
+            uint32_t offset = if_id.second & 0xffff;
+            offset = (offset >> 15) ? 0xffff0000 | offset : offset;
+            id_ex.branch = true;
+            id_ex.bne = (if_id.second >> 26) == 0x5;
+            id_ex.branch_target = if_id.pc + 8 + (offset << 2);
+        }
+
+        // Early branch resolution: beq/bne, j/jal and jr/jalr leave ID with their outcome.
+        // The comparator reads the forwarded operands; a source still being computed in EX or
+        // loaded in MEM this cycle holds the branch in ID for a cycle
+        if (early_branch && (control.branch || control.jump)) {
+            bool uses_rs = control.branch || control.jump_reg;
+            bool uses_rt = control.branch;
+            bool pending = false;
+            if (ex_mem.reg_write && ex_mem.write_reg != 0) {
+                pending |= (uses_rs && id_ex.rs == ex_mem.write_reg) || (uses_rt && id_ex.rt == ex_mem.write_reg);
+            }
+            if (mem_wb.reg_write && mem_wb.mem_to_reg && mem_wb.write_reg != 0) {
+                pending |= (uses_rs && id_ex.rs == mem_wb.write_reg) || (uses_rt && id_ex.rt == mem_wb.write_reg);
+            }
+            if (pending) {
+                stats.interlocks++;
+                memset(&id_ex, 0, sizeof(ID_EX_reg));
+                return;
+            }
+            bool taken = control.jump || ((id_ex.read_data_1 == id_ex.read_data_2) != control.bne);
+
+            // resolved: EX only carries the link of jal/jalr
+            id_ex.branch = id_ex.bne = id_ex.jump = id_ex.jump_reg = false;
+            id_ex.rs = id_ex.rt = 0;
+            uint32_t target = control.jump_reg ? id_ex.read_data_1 : control.jump ? id_ex.jump_target : id_ex.branch_target;
+            if (branch_mispredicted(id_ex.pc, id_ex.next_pc, taken, control.jump_reg, target, current_pc)) {
+                // the wrong instruction is not fetched, one bubble
+                memset(&if_id, 0, sizeof(IF_ID_reg));
+                return;
+            }
+        }
  
 
 
         //IF stage
-        uint32_t next_instruction;
-        if (!memory->access(current_pc, next_instruction, 0, 1, 0)){
+        HOST_PROFILE_STAGE(HOST_FETCH);
+        // A marker in flight serializes: nothing behind it is fetched until it has retired
+        if (roi && (marker || id_ex.marker || ex_mem.marker || mem_wb.marker)) {
             memset(&if_id, 0, sizeof(IF_ID_reg));
             return;
         }
-        if_id.instruction = next_instruction;
-        if_id.pc = current_pc;  
+        FetchEntry entry;
+        int fused_kind = FUSE_NONE;
+        if (front_end.enabled()) {
+            if (!front_end.pop(entry)) {
+                stats.fetchStalls++;
+                memset(&if_id, 0, sizeof(IF_ID_reg));
+                return;
+            }
+
+            // the next instruction joins this one if it is already buffered and they form an idiom
+            FetchEntry next;
+            if (fusion && front_end.peek(next) && next.pc == entry.pc + 4 && entry.next_pc == next.pc) {
+                fused_kind = fusion_kind(entry.instruction, next.instruction);
+            }
+            if (fused_kind != FUSE_NONE) {
+                front_end.pop(next);
+                if_id.second = next.instruction;
+                entry.next_pc = next.next_pc;
+            }
+        } else {
+            // another hardware context has the fetch slot this cycle
+            if (!fetch_granted && !fetch_miss) {
+                memset(&if_id, 0, sizeof(IF_ID_reg));
+                return;
+            }
+            fetch_miss = !memory->fetch(current_pc, entry.instruction, core_id);
+            if (fetch_miss) {
+                stats.fetchStalls++;
+                memset(&if_id, 0, sizeof(IF_ID_reg));
+                return;
+            }
+            entry.pc = current_pc;
+            entry.next_pc = current_pc + 4;
+        }
+        if_id.instruction = entry.instruction;
+        if_id.pc = entry.pc;  
+        if_id.next_pc = entry.next_pc;
+        if_id.fused = fused_kind;
+        if_id.ops = fused_kind != FUSE_NONE ? 2 : 1;
     }else{
         memset(&id_ex, 0, sizeof(ID_EX_reg));
         memset(&if_id, 0, sizeof(IF_ID_reg));
     }
     current_pc = new_pc;
         
-}
\ No newline at end of file
+}
+
+
+// Value of a source register for the instruction leaving decode stage s, false if an
+// older instruction still has to produce it. The youngest older writer forwards its result
+// from the cycle after it completed the last execute stage (last memory stage for loads).
+bool Processor::read_operand(int reg, int s, uint32_t &value) {
+    int exec_end = pipeline.fetch + pipeline.decode + pipeline.execute;
+    int mem_end = exec_end + pipeline.memory;
+    for (int i = s+1; i < (int)stages.size(); i++) {
+        PipeSlot &p = stages[i];
+        if (p.valid && p.control.reg_write && p.write_reg == reg && reg != 0) {
+            // stage the producer was in at the start of this cycle
+            int done = p.entered == cycle ? i-1 : i;
+            if (done < (p.control.mem_read ? mem_end-1 : exec_end-1)) {
+                return false;
+            }
+            value = p.result;
+            return true;
+        }
+    }
+    uint32_t dummy;
+    regfile.access(reg, 0, value, dummy, 0, false, 0);
+    return true;
+}
+
+// Generic in-order pipeline: each phase spans the configured number of stages and a slot in
+// stage s has completed the work of stage s. Every cycle the last stage writes back, then
+// slots move one stage on, oldest first, when the next stage is free. Operands are read when
+// entering execute, the L1 accesses complete on entering the first fetch and memory stages,
+// and branches resolve on entering the last execute stage, flushing everything behind them.
+// With one stage per phase this has the timing of the five-stage model.
+void Processor::deep_pipelined_processor_advance() {
+    cycle++;
+    int decode_start = pipeline.fetch;
+    int exec_start = decode_start + pipeline.decode;
+    int exec_end = exec_start + pipeline.execute;
+    int mem_start = exec_end;
+    int last = stages.size()-1;
+
+    // WB Stage
+    HOST_PROFILE_STAGES(HOST_WRITEBACK);
+    PipeSlot &wb = stages[last];
+    if (wb.valid && wb.control.reg_write) {
+        uint32_t read_data_1, read_data_2;
+        regfile.access(0, 0, read_data_1, read_data_2, wb.write_reg, true, wb.result);
+    }
+    regfile.pc = wb.valid ? wb.pc : 0;
+    if (roi && wb.valid && wb.control.marker) {
+        marker = wb.control.marker;
+    }
+    stats.retired += wb.valid;
+    wb.valid = false;
+
+    HOST_PROFILE_STAGE(HOST_FETCH);
+    if (front_end.enabled() && (fetch_granted || front_end.missPending())) {
+        front_end.tick();
+    }
+
+    bool flush = false;
+    for (int s = last-1; s >= 0 && !flush; s--) {
+        PipeSlot &slot = stages[s];
+        if (!slot.valid || stages[s+1].valid) {
+            continue;
+        }
+        HOST_PROFILE_STAGE(s+1 < decode_start ? HOST_FETCH : s+1 < exec_start ? HOST_DECODE :
+                           s+1 < mem_start ? HOST_EXECUTE : HOST_MEMORY_STAGE);
+        int funct = slot.instruction & 0x3f;
+
+        // Entering decode
+        if (s+1 == decode_start) {
+            slot.control.decode(slot.instruction);
+            slot.rs = (slot.instruction >> 21) & 0x1f;
+            slot.rt = (slot.instruction >> 16) & 0x1f;
+            int rd = (slot.instruction >> 11) & 0x1f;
+            slot.write_reg = slot.control.link && !slot.control.reg_dest ? 31 : slot.control.reg_dest ? rd : slot.rt;
+        }
+
+        // Entering execute: read operands through forwarding, or hold the instruction in decode
+        if (s+1 == exec_start) {
+            bool uses_rs = !slot.control.shift && !(slot.control.jump && !slot.control.jump_reg);
+            bool uses_rt = (!slot.control.ALU_src && !slot.control.jump) || slot.control.mem_write || slot.control.branch;
+            if ((uses_rs && !read_operand(slot.rs, s, slot.read_data_1)) ||
+                (uses_rt && !read_operand(slot.rt, s, slot.read_data_2))) {
+                stats.interlocks++;
+                continue;
+            }
+
+            // mfhi/mflo wait for the multiplier/divider and for any mult/div that has not
+            // written HI/LO yet, a divide waits for the divider
+            bool hilo_pending = false;
+            for (int i = exec_start; i < exec_end-1; i++) {
+                hilo_pending |= stages[i].valid && stages[i].control.mul_div;
+            }
+            if ((slot.control.move_hilo && (hilo_pending || cycle < hilo_ready)) ||
+                (slot.control.mul_div && funct >= 0x1a && cycle < div_free)) {
+                stats.interlocks++;
+                continue;
+            }
+
+            int opcode = (slot.instruction >> 26) & 0x3f;
+            int shamt = (slot.instruction >> 6) & 0x1f;
+            uint32_t imm = slot.instruction & 0xffff;
+            imm = slot.control.zero_extend ? imm : (imm >> 15) ? 0xffff0000 | imm : imm;
+            uint32_t alu_zero;
+            alu.generate_control_inputs(slot.control.ALU_op, funct, opcode);
+            slot.result = alu.execute(slot.control.shift ? shamt : slot.read_data_1, slot.control.ALU_src ? imm : slot.read_data_2, alu_zero);
+            if (slot.control.mul_div) {
+                uint64_t latency = funct >= 0x1a ? div_latency : mul_latency;
+                hilo_ready = max(hilo_ready, cycle + latency);
+                if (funct >= 0x1a) {
+                    div_free = cycle + div_latency;
+                }
+            }
+            if (slot.control.link) {
+                slot.result = slot.pc + 8;
+            }
+        }
+
+        // Entering the last execute stage: HI/LO and the branch outcome; younger
+        // instructions are squashed below once this slot has moved
+        if (s+1 == exec_end-1) {
+            if (slot.control.mul_div) {
+                alu.execute_hilo(funct, slot.read_data_1, slot.read_data_2, regfile.hi, regfile.lo);
+            }
+            if (slot.control.move_hilo) {
+                slot.result = funct == 0x10 ? regfile.hi : regfile.lo;
+            }
+            bool equal = slot.read_data_1 == slot.read_data_2;
+            bool taken = (slot.control.branch && !slot.control.bne && equal) || (slot.control.bne && !equal);
+            if (slot.control.branch || slot.control.jump) {
+                uint32_t imm = slot.instruction & 0xffff;
+                imm = (imm >> 15) ? 0xffff0000 | imm : imm;
+                uint32_t target = slot.control.jump_reg ? slot.read_data_1 :
+                                  slot.control.jump ? (slot.pc & 0xf0000000) | ((slot.instruction & 0x03ffffff) << 2) :
+                                  slot.pc + 4 + (imm << 2);
+                flush = branch_mispredicted(slot.pc, slot.next_pc, taken || slot.control.jump, slot.control.jump_reg, target, fetch_pc);
+            }
+        }
+
+        // Entering memory: the access repeats every cycle until the cache returns it
+        if (s+1 == mem_start && (slot.control.mem_read || slot.control.mem_write)) {
+            uint32_t read_data_mem = 0;
+            uint32_t write_data_mem = slot.read_data_2;
+            bool needs_read = slot.control.mem_read || slot.control.halfword || slot.control.byte;
+            if (needs_read && !memory->access(slot.result, read_data_mem, 0, true, false, core_id)) {
+                stats.memoryStalls++;
+                continue;
+            }
+            if (slot.control.mem_write) {
+                write_data_mem = store_lane(read_data_mem, slot.read_data_2, slot.result, slot.control.halfword, slot.control.byte);
+                if (!memory->access(slot.result, read_data_mem, write_data_mem, false, true, core_id)) {
+                    stats.memoryStalls++;
+                    continue;
+                }
+            }
+            read_data_mem = load_lane(read_data_mem, slot.result, slot.control.halfword, slot.control.byte, slot.control.load_signed);
+            record_access(slot.pc, slot.result, slot.control.mem_write, slot.control.halfword, slot.control.byte);
+            if (slot.control.mem_read) {
+                slot.result = read_data_mem;
+            }
+        }
+
+        slot.entered = cycle;
+        stages[s+1] = slot;
+        slot.valid = false;
+    }
+
+    // Taken (or mispredicted) branch or jump: squash everything younger, fetch the target next cycle
+    if (flush) {
+        for (int s = 0; s < exec_end-1; s++) {
+            stages[s].valid = false;
+        }
+        return;
+    }
+
+    // IF stage: a marker in flight serializes, nothing behind it is fetched until it has retired
+    HOST_PROFILE_STAGE(HOST_FETCH);
+    bool serialize = roi && marker;
+    for (int s = 0; roi && s < last; s++) {
+        serialize |= stages[s].valid && marker_code(stages[s].instruction);
+    }
+    if (!stages[0].valid && !serialize) {
+        FetchEntry entry;
+        if (front_end.enabled()) {
+            if (!front_end.pop(entry)) {
+                stats.fetchStalls++;
+                return;
+            }
+        } else {
+            if (!fetch_granted && !fetch_miss) {
+                return;
+            }
+            fetch_miss = !memory->fetch(fetch_pc, entry.instruction, core_id);
+            if (fetch_miss) {
+                stats.fetchStalls++;
+                return;
+            }
+            entry.pc = fetch_pc;
+            entry.next_pc = fetch_pc + 4;
+        }
+        memset(&stages[0], 0, sizeof(PipeSlot));
+        stages[0].valid = true;
+        stages[0].instruction = entry.instruction;
+        stages[0].pc = entry.pc;
+        stages[0].next_pc = entry.next_pc;
+        stages[0].entered = cycle;
+        fetch_pc += 4;
+    }
+}
+
+// Scoreboard model: IF, then decode and in-order issue, then out-of-order completion.
+// Issue waits while a source or the destination has a result pending (RAW/WAW, from the
+// ready bit of the register), while its functional unit is busy (one load or store in the
+// load/store unit at a time, the divider, mfhi/mflo waiting for HI/LO) and reads its operands
+// as it leaves, so no later write can overtake a read (WAR). ALU results are written back
+// the next cycle, loads the cycle after the L1D returns them, so independent instructions
+// keep issuing under a miss. Branches and jumps resolve at issue.
+void Processor::scoreboard_processor_advance() {
+    HOST_PROFILE_STAGES(HOST_MEMORY_STAGE);
+    cycle++;
+
+    if (front_end.enabled() && (fetch_granted || front_end.missPending())) {
+        front_end.tick();
+    }
+
+    // Load/store unit: the oldest memory operation repeats its access until the cache returns it
+    for (ScoreboardEntry &e : issued) {
+        if (!(e.mem_read || e.mem_write) || e.done) {
+            continue;
+        }
+        uint32_t read_data_mem = 0;
+        if ((e.mem_read || e.halfword || e.byte) && !memory->access(e.result, read_data_mem, 0, true, false, core_id)) {
+            stats.memoryStalls++;
+            break;
+        }
+        if (e.mem_write) {
+            uint32_t write_data_mem = store_lane(read_data_mem, e.store_data, e.result, e.halfword, e.byte);
+            if (!memory->access(e.result, read_data_mem, write_data_mem, false, true, core_id)) {
+                stats.memoryStalls++;
+                break;
+            }
+        }
+        record_access(e.pc, e.result, e.mem_write, e.halfword, e.byte);
+        read_data_mem = load_lane(read_data_mem, e.result, e.halfword, e.byte, e.load_signed);
+        if (e.mem_read) {
+            e.result = read_data_mem;
+        }
+        e.done = cycle + 1;
+        break;
+    }
+
+    // Writeback of every completed result, in any order; retirement in program order
+    HOST_PROFILE_STAGE(HOST_WRITEBACK);
+    for (ScoreboardEntry &e : issued) {
+        if (e.done && e.done <= cycle && !e.written) {
+            uint32_t read_data_1, read_data_2;
+            regfile.access(0, 0, read_data_1, read_data_2, e.write_reg, e.write_reg != 0, e.result);
+            e.written = true;
+        }
+    }
+    while (!issued.empty() && issued.front().written) {
+        regfile.pc = issued.front().pc;
+        if (roi && issued.front().marker) {
+            marker = issued.front().marker;
+        }
+        stats.retired++;
+        issued.pop_front();
+    }
+
+    // Issue
+    HOST_PROFILE_STAGE(HOST_DECODE);
+    bool redirect = false;
+    if (if_id.ops) {
+        uint32_t instruction = if_id.instruction;
+        control_t control;
+        control.decode(instruction);
+        int opcode = (instruction >> 26) & 0x3f;
+        int rs = (instruction >> 21) & 0x1f;
+        int rt = (instruction >> 16) & 0x1f;
+        int rd = (instruction >> 11) & 0x1f;
+        int shamt = (instruction >> 6) & 0x1f;
+        int funct = instruction & 0x3f;
+        int write_reg = !control.reg_write ? 0 : control.link && !control.reg_dest ? 31 : control.reg_dest ? rd : rt;
+        bool uses_rs = !control.shift && !(control.jump && !control.jump_reg);
+        bool uses_rt = (!control.ALU_src && !control.jump) || control.mem_write || control.branch;
+
+        bool memory_busy = false;
+        for (ScoreboardEntry &e : issued) {
+            memory_busy |= (e.mem_read || e.mem_write) && !e.done;
+        }
+        bool blocked = (uses_rs && !regfile.ready(rs)) || (uses_rt && !regfile.ready(rt)) ||
+                       (write_reg && !regfile.ready(write_reg)) ||
+                       ((control.mem_read || control.mem_write) && memory_busy) ||
+                       (control.move_hilo && cycle < hilo_ready) ||
+                       (control.mul_div && funct >= 0x1a && cycle < div_free) ||
+                       (roi && control.marker && !issued.empty());
+        if (blocked) {
+            stats.interlocks++;
+        } else {
+            HOST_PROFILE_STAGE(HOST_EXECUTE);
+            uint32_t read_data_1, read_data_2;
+            regfile.access(rs, rt, read_data_1, read_data_2, 0, false, 0);
+            uint32_t imm = instruction & 0xffff;
+            imm = control.zero_extend ? imm : (imm >> 15) ? 0xffff0000 | imm : imm;
+            uint32_t alu_zero;
+            alu.generate_control_inputs(control.ALU_op, funct, opcode);
+            uint32_t result = alu.execute(control.shift ? shamt : read_data_1, control.ALU_src ? imm : read_data_2, alu_zero);
+            if (control.mul_div) {
+                alu.execute_hilo(funct, read_data_1, read_data_2, regfile.hi, regfile.lo);
+                uint64_t latency = funct >= 0x1a ? div_latency : mul_latency;
+                hilo_ready = max(hilo_ready, cycle + latency);
+                if (funct >= 0x1a) {
+                    div_free = cycle + div_latency;
+                }
+            }
+            if (control.move_hilo) {
+                result = funct == 0x10 ? regfile.hi : regfile.lo;
+            }
+            if (control.link) {
+                result = if_id.pc + 8;
+            }
+
+            if (control.branch || control.jump) {
+                bool equal = read_data_1 == read_data_2;
+                bool taken = control.jump || (control.bne ? !equal : equal);
+                uint32_t target = control.jump_reg ? read_data_1 :
+                                  control.jump ? (if_id.pc & 0xf0000000) | ((instruction & 0x03ffffff) << 2) :
+                                  if_id.pc + 4 + (imm << 2);
+                redirect = branch_mispredicted(if_id.pc, if_id.next_pc, taken, control.jump_reg, target, fetch_pc);
+            }
+
+            ScoreboardEntry e;
+            memset(&e, 0, sizeof(ScoreboardEntry));
+            e.pc = if_id.pc;
+            e.write_reg = write_reg;
+            e.result = result;
+            e.mem_read = control.mem_read;
+            e.mem_write = control.mem_write;
+            e.halfword = control.halfword;
+            e.byte = control.byte;
+            e.load_signed = control.load_signed;
+            e.store_data = read_data_2;
+            e.marker = control.marker;
+            e.done = control.mem_read || control.mem_write ? 0 : cycle + 1;
+            issued.push_back(e);
+            regfile.reserve(write_reg);
+            if_id.ops = 0;
+        }
+    }
+
+    // IF: a taken or mispredicted branch drops the instruction fetched behind it this cycle,
+    // and a marker in flight serializes: nothing behind it is fetched until it has retired
+    HOST_PROFILE_STAGE(HOST_FETCH);
+    if (redirect || if_id.ops || (roi && (marker || (!issued.empty() && issued.back().marker)))) {
+        return;
+    }
+    FetchEntry entry;
+    if (front_end.enabled()) {
+        if (!front_end.pop(entry)) {
+            stats.fetchStalls++;
+            return;
+        }
+    } else {
+        if (!fetch_granted && !fetch_miss) {
+            return;
+        }
+        fetch_miss = !memory->fetch(fetch_pc, entry.instruction, core_id);
+        if (fetch_miss) {
+            stats.fetchStalls++;
+            return;
+        }
+        entry.pc = fetch_pc;
+        entry.next_pc = fetch_pc + 4;
+    }
+    if_id.instruction = entry.instruction;
+    if_id.pc = entry.pc;
+    if_id.next_pc = entry.next_pc;
+    if_id.ops = 1;
+    fetch_pc += 4;
+}
@@ -1,7 +1,187 @@
+#ifndef PROCESSOR
+#define PROCESSOR
+#include <cstring>
+#include <deque>
 #include "memory.h"
 #include "regfile.h"
 #include "ALU.h"
 #include "control.h"
+#include "frontend.h"
+#include "valuepred.h"
+#include "memtrace.h"
+
+// Timing models; a run picks one at startup and the simulation loop is instantiated for it
+enum TimingModel {
+    SINGLE_CYCLE,           // -O0
+    FIVE_STAGE,             // -O1 and up
+    CONFIGURABLE_PIPELINE,  // -O1 and up with --pipeline
+    SCOREBOARD              // -O1 and up with --scoreboard
+};
+
+// Trace sinks: what a run prints every cycle. The simulation loops and the single-cycle model
+// are instantiated per sink, so a run without a trace does no per-cycle output work at all.
+struct CycleTrace {
+    static const bool enabled = true;       // register file every cycle, decode of the single-cycle model
+};
+struct NoTrace {
+    static const bool enabled = false;
+};
+
+// Instruction pairs decode issues as one internal op (five-stage model with a front end)
+enum FusionKind {
+    FUSE_NONE,
+    FUSE_CONSTANT,          // lui + ori/addiu of the same register: one 32-bit constant
+    FUSE_COMPARE_BRANCH,    // slt/sltu/slti/sltiu + beq/bne on its result against $zero
+    FUSE_ADDRESS,           // addiu/lui + load through and into the same register
+    FUSE_KINDS
+};
+
+struct IF_ID_reg {
+    uint32_t instruction;
+    uint32_t pc;
+    uint32_t next_pc;       // address fetch continued at after this instruction
+    int fused;              // FusionKind of this instruction and the next one
+    uint32_t second;        // the next instruction, if fused
+    int ops;                // instructions this latch holds: 0 for a bubble, 2 for a fused pair
+};
+
+struct ID_EX_reg {
+    // Data read from registers
+    uint32_t read_data_1;
+    uint32_t read_data_2;
+    
+    // Instruction fields decoded in ID
+    int opcode;
+    int rs;
+    int rt;
+    int rd;
+    int shamt;
+    int funct;
+    uint32_t imm;
+    
+    // Control signals
+    bool ALU_src;
+    bool reg_dest;
+    unsigned ALU_op : 2;
+    bool shift;
+    bool mem_read;
+    bool mem_write;
+    bool halfword;
+    bool byte;
+    bool load_signed;
+    bool reg_write;
+    bool mem_to_reg;
+    bool mul_div;
+    bool move_hilo;
+
+    // Branch/Jump control
+    bool branch;
+    bool bne;
+    bool jump;
+    bool jump_reg;
+    bool link;
+    uint32_t branch_target;
+    uint32_t jump_target;
+    uint32_t pc;
+    uint32_t next_pc;
+    int fused;
+    int ops;
+    int marker;             // MarkerCode, carried to WB so it acts when it retires
+};
+
+struct EX_MEM_reg {
+    uint32_t alu_result;
+    uint32_t write_data;
+    int write_reg;
+    
+    bool mem_read;
+    bool mem_write;
+    bool halfword;
+    bool byte;
+    bool load_signed;
+    bool reg_write;
+    bool mem_to_reg;
+    
+    // Branch results
+    bool branch_taken;
+    uint32_t branch_target;
+    bool jump;
+    uint32_t jump_target;
+    uint32_t pc;
+    bool link;
+
+    // Load value prediction: dependents in EX use predicted_value until the load returns
+    bool predicted;
+    uint32_t predicted_value;
+    int ops;
+    int marker;
+};
+
+struct MEM_WB_reg {
+    uint32_t read_data;
+    uint32_t alu_result;
+    int write_reg;
+    
+    bool reg_write;
+    bool mem_to_reg;
+    uint32_t pc;
+    bool link;
+    int ops;
+    int marker;
+};
+
+// Stage counts of the configurable pipeline; writeback retires from the last memory stage.
+// Splitting a phase over more stages shortens the cycle (see getCycleTime()).
+struct PipelineConfig {
+    int fetch;          // stages of the L1I access, an instruction is available after the last one
+    int decode;         // decode/register read stages
+    int execute;        // ALU stages, results forward after the last one; branches resolve there
+    int memory;         // stages of the L1D access, loaded data forwards after the last one
+};
+
+// An instruction in flight in the configurable pipeline
+struct PipeSlot {
+    bool valid;
+    uint32_t instruction;
+    uint32_t pc;
+    uint32_t next_pc;
+    control_t control;
+    int rs;
+    int rt;
+    int write_reg;
+    uint32_t read_data_1;
+    uint32_t read_data_2;
+    uint32_t result;        // ALU result, link address or loaded data
+    uint64_t entered;       // cycle this slot moved into its current stage
+};
+
+// An instruction the scoreboard model has issued, until it retires. Results are written back
+// as they complete, in any order; retirement (the PC the run follows) stays in program order.
+struct ScoreboardEntry {
+    uint32_t pc;
+    int write_reg;          // 0 if it writes no register
+    uint32_t result;
+    uint64_t done;          // cycle the result is written back, 0 while in the load/store unit
+    bool written;
+    bool mem_read;
+    bool mem_write;
+    bool halfword;
+    bool byte;
+    bool load_signed;
+    uint32_t store_data;
+    int marker;             // MarkerCode
+};
+
+// Per-core counters of the timing models, printed by --stats and sampled by --interval
+struct CoreStats {
+    uint64_t cycles;
+    uint64_t retired;           // instructions written back, a fused pair counts as two
+    uint64_t fetchStalls;       // cycles decode got no instruction: L1I miss or empty buffer
+    uint64_t memoryStalls;      // cycles a load or store waited for the L1D
+    uint64_t interlocks;        // cycles an instruction waited for an operand, HI/LO or the divider
+    uint64_t mispredicts;       // branches and jumps that redirected fetch
+};
+
 class Processor {
     private:
         int opt_level;
@@ -9,16 +189,214 @@ class Processor {
         control_t control;
         Memory *memory;
         Registers regfile;
+        int core_id;
         // add other structures as needed
 
         // pipelined processor
+        IF_ID_reg if_id;
+        ID_EX_reg id_ex;
+        EX_MEM_reg ex_mem;
+        MEM_WB_reg mem_wb;
+        uint32_t current_pc;
+
+        // multi-cycle units of the pipelined processor: a pipelined multiplier and an
+        // iterative divider, both writing HI/LO
+        int mul_latency;
+        int div_latency;
+        uint64_t cycle;
+        uint64_t hilo_ready;        // first cycle mfhi/mflo can execute
+        uint64_t div_free;          // first cycle the divider accepts a new divide
+
+        bool early_branch;          // resolve branches and jumps in ID instead of EX
+
+        // configurable pipeline, used instead of the five latches above once configured
+        bool generic_pipeline;
+        PipelineConfig pipeline;
+        std::vector<PipeSlot> stages;
+        uint32_t fetch_pc;
+
+        // scoreboard model: issued instructions in program order, off unless configured
+        bool scoreboard;
+        std::deque<ScoreboardEntry> issued;
+
+        // decoupled front end feeding decode in the pipelined models, off unless configured
+        FrontEnd front_end;
+
+        // load value predictor of the five-stage model, off unless configured
+        LoadValuePredictor value_predictor;
+
+        // macro-op fusion in decode, and the pairs fused per FusionKind
+        bool fusion;
+        uint64_t fused[FUSE_KINDS];
+
+        CoreStats stats;
+
+        // region of interest: with roi set, markers serialize the pipeline and the code of
+        // the last one retired waits in marker until the simulation loop takes it
+        bool roi;
+        int marker;
+
+        // hardware contexts: fetch only in the cycles the core's fetch policy grants, except
+        // to complete an L1I miss already outstanding
+        bool fetch_granted;
+        bool fetch_miss;
+
+        // receives every completed data access when a memory trace is captured
+        MemoryTraceWriter *mem_trace;
+        void record_access(uint32_t pc, uint32_t address, bool write, bool halfword, bool byte) {
+            if (mem_trace) {
+                mem_trace->record(pc, address, write, halfword ? 2 : byte ? 1 : 4);
+            }
+        }
 
         // add private functions
-        void single_cycle_processor_advance();
+        template <class Trace> void single_cycle_processor_advance();
+        void trace_instruction(uint32_t instruction);
         void pipelined_processor_advance();
+        void deep_pipelined_processor_advance();
+        void scoreboard_processor_advance();
+
+        // Value of a source register for the instruction leaving decode stage s, false if an
+        // older instruction still has to produce it
+        bool read_operand(int reg, int s, uint32_t &value);
+
+        // A branch or jump at pc resolved; true if fetch did not continue at the right address,
+        // which is then left in next_pc (the front end is redirected there already)
+        bool branch_mispredicted(uint32_t pc, uint32_t predicted, bool taken, bool jump_reg, uint32_t target, uint32_t &next_pc);
  
     public:
-        Processor(Memory *mem) { regfile.pc = 0; memory = mem;}
+        // core is this processor's id in a multicore run, exposed to software in $k0
+        Processor(Memory *mem, int core = 0) {
+            regfile.pc = 0;
+            memory = mem;
+            core_id = core;
+            current_pc = 0;
+            mul_latency = 4;
+            div_latency = 32;
+            cycle = 0;
+            hilo_ready = 0;
+            div_free = 0;
+            early_branch = false;
+            generic_pipeline = false;
+            pipeline = {1, 1, 1, 1};
+            fetch_pc = 0;
+            scoreboard = false;
+            fusion = false;
+            memset(fused, 0, sizeof(fused));
+            mem_trace = nullptr;
+            roi = false;
+            marker = MARKER_NONE;
+            fetch_granted = true;
+            fetch_miss = false;
+            stats = CoreStats();
+            memset(&if_id, 0, sizeof(IF_ID_reg));
+            memset(&id_ex, 0, sizeof(ID_EX_reg));
+            memset(&ex_mem, 0, sizeof(EX_MEM_reg));
+            memset(&mem_wb, 0, sizeof(MEM_WB_reg));
+            uint32_t dummy;
+            regfile.access(0, 0, dummy, dummy, 26, true, core_id);
+        }
+
+        int getCoreId() { return core_id; }
+
+        // Resolve beq/bne and j/jal/jr/jalr in ID (pipelined model), one bubble per taken branch
+        void setEarlyBranch(bool enable) { early_branch = enable; }
+
+        // Cycles from a mult/div entering EX until mfhi/mflo can use its result (at least 1)
+        void setUnitLatencies(int mul, int div) {
+            mul_latency = mul;
+            div_latency = div;
+        }
+
+        // Switch the pipelined model to the configurable pipeline with these stage counts
+        void setPipeline(const PipelineConfig &config) {
+            generic_pipeline = true;
+            pipeline = config;
+            PipeSlot empty;
+            memset(&empty, 0, sizeof(PipeSlot));
+            stages.assign(config.fetch + config.decode + config.execute + config.memory, empty);
+        }
+
+        // Switch the pipelined model to scoreboard issue: in-order issue once operands, the
+        // destination and the functional unit are free, out-of-order completion
+        void setScoreboard(bool enable) { scoreboard = enable; }
+
+        // Fetch ahead into an instruction buffer of this many entries (0: fetch straight into
+        // IF/ID), width words per cycle, and replay backward-branch loops of up to loop_entries
+        // instructions from a loop buffer
+        void setFrontEnd(int entries, int width, int loop_entries) {
+            front_end.configure(memory, core_id, entries, width, loop_entries);
+        }
+
+        // Fuse common instruction pairs in decode when both are in the instruction buffer
+        // (five-stage model with a front end)
+        void setFusion(bool enable) { fusion = enable; }
+
+        // Predict load values from a table of this many entries once a stride has repeated
+        // confidence times (five-stage model); a dependent that used a wrong value is replayed
+        void setValuePredictor(int entries, int confidence) {
+            value_predictor.configure(entries, confidence);
+        }
+
+        // Record the data accesses of this core (PC, address, read/write, size) into a trace
+        void setMemoryTrace(MemoryTraceWriter *writer) { mem_trace = writer; }
+
+        // Hardware contexts of one core share its pipeline and caches; the fetch policy gives one
+        // of them the fetch slot each cycle
+        void setFetchGrant(bool granted) { fetch_granted = granted; }
+        bool fetchMissPending() { return fetch_miss || front_end.missPending(); }
+
+        // Instructions fetched but not yet executed, the count ICOUNT fetches for the lowest of
+        int instructionCount();
+
+        // Act on the marker instructions (see control.h)
+        void setROI(bool enable) { roi = enable; }
+
+        // Code of the marker retired since the last call, MARKER_NONE if there is none
+        int takeMarker() {
+            int code = marker;
+            marker = MARKER_NONE;
+            return code;
+        }
+
+        // Switch from functional execution to the timing model at the current PC: empty the
+        // pipeline, point fetch at the next instruction and clear the statistics
+        void startDetailed();
+
+        const CoreStats &getStats() { return stats; }
+
+        // Print the retirement and stall counters, and the front end, fusion and value
+        // predictor counters for those that are enabled
+        void printStats() {
+            std::cout << "Core " << core_id << " retired: " << stats.retired << " cycles: " << stats.cycles
+                      << " stalls fetch: " << stats.fetchStalls << " memory: " << stats.memoryStalls
+                      << " interlock: " << stats.interlocks << " mispredicts: " << stats.mispredicts << "\n";
+            if (front_end.enabled()) {
+                front_end.printStats();
+            }
+            if (fusion) {
+                std::cout << "Fused constants: " << fused[FUSE_CONSTANT] << " compare-branches: " << fused[FUSE_COMPARE_BRANCH]
+                          << " address-loads: " << fused[FUSE_ADDRESS] << "\n";
+            }
+            if (value_predictor.enabled()) {
+                value_predictor.printStats();
+            }
+        }
+
+        // Optimization levels above 1 run the pipelined models as well
+        TimingModel getTimingModel() {
+            return opt_level == 0 ? SINGLE_CYCLE : scoreboard ? SCOREBOARD : generic_pipeline ? CONFIGURABLE_PIPELINE : FIVE_STAGE;
+        }
+
+        // Nanoseconds per cycle: the five-stage design runs at 0.5ns, i.e. 0.4ns of logic per
+        // phase plus 0.1ns of latch overhead; splitting a phase divides its logic delay
+        double getCycleTime() {
+            if (getTimingModel() != CONFIGURABLE_PIPELINE) {
+                return 0.5;
+            }
+            int slowest = std::min(std::min(pipeline.fetch, pipeline.decode), std::min(pipeline.execute, pipeline.memory));
+            return 0.4 / slowest + 0.1;
+        }
 
         // Get PC
         uint32_t getPC() { return regfile.pc; }
@@ -29,6 +407,21 @@ class Processor {
         // Initializes the processor appropriately based on the optimization level
         void initialize(int opt_level);
 
-        // Advances the processor to an appropriate state every cycle
-        void advance(); 
+        // Advances the processor to an appropriate state every cycle; Model must be
+        // getTimingModel(), fixed at compile time so no cycle dispatches on it
+        template <TimingModel Model, class Trace>
+        void advance() {
+            memory->tick(core_id);
+            stats.cycles++;
+            if (Model == SINGLE_CYCLE) {
+                single_cycle_processor_advance<Trace>();
+            } else if (Model == FIVE_STAGE) {
+                pipelined_processor_advance();
+            } else if (Model == SCOREBOARD) {
+                scoreboard_processor_advance();
+            } else {
+                deep_pipelined_processor_advance();
+            }
+        }
 };
+#endif
@@ -17,7 +17,8 @@ class Registers {
         std::vector<int> rename_pool;
     public:
         uint32_t pc;
-        Registers() {
+        uint32_t hi, lo;        // results of mult/div, read by mfhi/mflo
+        Registers() : hi(0), lo(0) {
             R.resize(32);
             for (int i = 0; i < 32; i++) {
                 R[i].value = 0;
@@ -43,6 +44,13 @@ class Registers {
             return R[reg].ready;
         }
 
+        // A result for reg is on its way: it reads as not ready until written ($zero never waits)
+        void reserve(int reg) {
+            if (reg) {
+                R[reg].ready = false;
+            }
+        }
+
         // Prints the contents of all the registers
         void print() {
             for(int i = 0; i < 32; ++i) {
@@ -0,0 +1,168 @@
+#ifndef REPLACEMENT
+#define REPLACEMENT
+#include <vector>
+#include <cstdint>
+#include <string>
+
+// Replacement state of a cache, kept outside the cache lines and indexed by set and way.
+// Invalid ways are always filled first by the cache; the policy only picks among valid ones.
+// touch() and insert() do constant work; victim() is only called on a miss.
+class ReplacementPolicy {
+    public:
+        virtual ~ReplacementPolicy() {}
+
+        // A hit on this way
+        virtual void touch(int set, int way) = 0;
+
+        // A new line was placed in this way
+        virtual void insert(int set, int way) = 0;
+
+        // Way to evict from a full set
+        virtual int victim(int set) = 0;
+
+        virtual const char *name() = 0;
+};
+
+// True LRU: each set keeps its ways in a doubly linked recency list, MRU at the head
+class LRUPolicy : public ReplacementPolicy {
+    private:
+        int assoc;
+        std::vector<int> prev, next;    // per line, -1 terminates
+        std::vector<int> head, tail;    // per set
+
+        void unlink(int set, int line) {
+            int base = set*assoc;
+            if (prev[line] >= 0) next[base+prev[line]] = next[line]; else head[set] = next[line];
+            if (next[line] >= 0) prev[base+next[line]] = prev[line]; else tail[set] = prev[line];
+        }
+    public:
+        LRUPolicy(int sets, int asc) : assoc(asc) {
+            prev.resize(sets*assoc);
+            next.resize(sets*assoc);
+            head.resize(sets, 0);
+            tail.resize(sets, assoc-1);
+            for (int s = 0; s < sets; s++) {
+                for (int w = 0; w < assoc; w++) {
+                    prev[s*assoc+w] = w-1;
+                    next[s*assoc+w] = w == assoc-1 ? -1 : w+1;
+                }
+            }
+        }
+        void touch(int set, int way) {
+            int line = set*assoc+way;
+            if (head[set] == way) {
+                return;
+            }
+            unlink(set, line);
+            prev[line] = -1;
+            next[line] = head[set];
+            prev[set*assoc+head[set]] = way;
+            head[set] = way;
+        }
+        void insert(int set, int way) { touch(set, way); }
+        int victim(int set) { return tail[set]; }
+        const char *name() { return "lru"; }
+};
+
+// Tree pseudo-LRU: assoc-1 bits per set, each node points at the half to evict next
+class TreePLRUPolicy : public ReplacementPolicy {
+    private:
+        int assoc;
+        int levels;
+        std::vector<uint8_t> tree;
+    public:
+        TreePLRUPolicy(int sets, int asc) : assoc(asc), levels(0) {
+            while ((1 << levels) < assoc) levels++;
+            tree.resize(sets*assoc, 0);
+        }
+        void touch(int set, int way) {
+            uint8_t *t = &tree[set*assoc];
+            int node = 0;
+            for (int l = levels-1; l >= 0; l--) {
+                int bit = (way >> l) & 1;
+                t[node] = !bit;
+                node = 2*node+1+bit;
+            }
+        }
+        void insert(int set, int way) { touch(set, way); }
+        int victim(int set) {
+            uint8_t *t = &tree[set*assoc];
+            int node = 0;
+            int way = 0;
+            for (int l = 0; l < levels; l++) {
+                way = (way << 1) | t[node];
+                node = 2*node+1+t[node];
+            }
+            return way;
+        }
+        const char *name() { return "plru"; }
+};
+
+// Static/bimodal re-reference interval prediction with 2-bit RRPVs.
+// SRRIP inserts with a long re-reference interval; BRRIP inserts with a distant one
+// and only every 32nd fill with a long one, so streaming data does not thrash the set.
+class RRIPPolicy : public ReplacementPolicy {
+    private:
+        enum { RRPV_MAX = 3 };
+        int assoc;
+        bool bimodal;
+        unsigned fills;
+        std::vector<uint8_t> rrpv;
+    public:
+        RRIPPolicy(int sets, int asc, bool brrip) : assoc(asc), bimodal(brrip), fills(0) {
+            rrpv.resize(sets*assoc, RRPV_MAX);
+        }
+        void touch(int set, int way) { rrpv[set*assoc+way] = 0; }
+        void insert(int set, int way) {
+            bool distant = bimodal && (fills++ & 31);
+            rrpv[set*assoc+way] = distant ? RRPV_MAX : RRPV_MAX-1;
+        }
+        int victim(int set) {
+            uint8_t *r = &rrpv[set*assoc];
+            while (true) {
+                for (int w = 0; w < assoc; w++) {
+                    if (r[w] == RRPV_MAX) {
+                        return w;
+                    }
+                }
+                for (int w = 0; w < assoc; w++) {
+                    r[w]++;
+                }
+            }
+        }
+        const char *name() { return bimodal ? "brrip" : "srrip"; }
+};
+
+// Random replacement (xorshift, fixed seed so runs are reproducible)
+class RandomPolicy : public ReplacementPolicy {
+    private:
+        int assoc;
+        uint32_t state;
+    public:
+        RandomPolicy(int asc) : assoc(asc), state(2463534242u) {}
+        void touch(int set, int way) {}
+        void insert(int set, int way) {}
+        int victim(int set) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state % assoc;
+        }
+        const char *name() { return "random"; }
+};
+
+// Create a policy by name (lru, plru, srrip, brrip, random), returns nullptr if unknown
+// or if the policy cannot handle this associativity
+inline ReplacementPolicy *makeReplacementPolicy(const std::string &name, int sets, int assoc) {
+    if (name == "lru") {
+        return new LRUPolicy(sets, assoc);
+    } else if (name == "plru") {
+        return (assoc & (assoc-1)) ? nullptr : new TreePLRUPolicy(sets, assoc);
+    } else if (name == "srrip" || name == "brrip") {
+        return new RRIPPolicy(sets, assoc, name == "brrip");
+    } else if (name == "random") {
+        return new RandomPolicy(assoc);
+    }
+    return nullptr;
+}
+#endif
@@ -0,0 +1,250 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <getopt.h>
+#include "memtrace.h"
+
+using namespace std;
+
+/* Single-pass LRU cache sizing from a memory trace (processor --mem-trace). Mattson's stack
+   algorithm: an access hits in every LRU cache larger than its stack distance, the number of
+   distinct lines touched since the previous access to its line, so one pass gives the miss
+   ratio of every capacity. Fully associative distances are counted with a Fenwick tree over
+   the time of each line's last access; set-associative ones come from one LRU stack per set
+   for every power-of-two set count, which covers all associativities of that set count at
+   once. The trace is streamed, only per-line state is kept. */
+
+// Number of lines accessed after a given time: a Fenwick tree over access times with a mark
+// at the last access of every line, renumbered when the times run out
+class StackDistance {
+    private:
+        vector<uint32_t> tree;
+        unordered_map<uint32_t, uint32_t> last;     // line -> time of its last access
+        uint32_t now;
+
+        void add(uint32_t t, int v) {
+            for (t++; t < tree.size(); t += t & -t) {
+                tree[t] += v;
+            }
+        }
+        uint32_t prefix(uint32_t t) {   // marks at times below t
+            uint32_t sum = 0;
+            for (; t; t -= t & -t) {
+                sum += tree[t];
+            }
+            return sum;
+        }
+        // Renumber the last accesses 0..n-1 in order, growing the tree if it is half full
+        void compact() {
+            vector<pair<uint32_t, uint32_t>> order;
+            for (auto &l : last) {
+                order.push_back({l.second, l.first});
+            }
+            sort(order.begin(), order.end());
+            size_t size = tree.size() - 1;
+            if (order.size() > size / 2) {
+                size *= 2;
+            }
+            tree.assign(size + 1, 0);
+            for (uint32_t t = 0; t < order.size(); t++) {
+                last[order[t].second] = t;
+                add(t, 1);
+            }
+            now = order.size();
+        }
+    public:
+        StackDistance() : tree((1 << 20) + 1, 0), now(0) {}
+
+        // Distance of an access to line, -1 for the first one
+        int64_t access(uint32_t line) {
+            if (now == tree.size() - 1) {
+                compact();
+            }
+            int64_t distance = -1;
+            auto it = last.find(line);
+            if (it != last.end()) {
+                distance = prefix(now) - prefix(it->second + 1);
+                add(it->second, -1);
+                it->second = now;
+            } else {
+                last[line] = now;
+            }
+            add(now++, 1);
+            return distance;
+        }
+        uint64_t lines() { return last.size(); }
+};
+
+// LRU stacks of maxAssoc lines for each set of a set count; hits[d] counts the accesses found
+// at depth d of their set, which hit in any cache of this set count with more than d ways
+struct SetStacks {
+    uint32_t sets;
+    vector<uint32_t> tags;
+    vector<uint64_t> hits;
+};
+
+static const uint32_t EMPTY = 0xffffffff;
+
+int log2i(uint64_t v) {
+    int l = 0;
+    while (v > 1) {
+        v >>= 1;
+        l++;
+    }
+    return l;
+}
+
+void print_help()
+{
+    cout << "Usage: stackdist --trace <path> [options]\n"
+            "--trace <path>                       Memory trace written by processor --mem-trace\n"
+            "--line <bytes>                       Line size (default 64)\n"
+            "--min-size <bytes>                   Smallest cache size reported (default 1024)\n"
+            "--max-size <bytes>                   Largest cache size reported (default 4194304)\n"
+            "--max-assoc <ways>                   Highest associativity reported (default 16)\n";
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+      {"trace", required_argument, 0, 't'},
+      {"line", required_argument, 0, 'l'},
+      {"min-size", required_argument, 0, 'm'},
+      {"max-size", required_argument, 0, 'M'},
+      {"max-assoc", required_argument, 0, 'a'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}
+    };
+    const char *path = nullptr;
+    uint32_t line_size = 64;
+    uint64_t min_size = 1024;
+    uint64_t max_size = 4194304;
+    uint32_t max_assoc = 16;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "h", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case 't':
+                path = optarg;
+                break;
+            case 'l':
+                line_size = strtoul(optarg, nullptr, 0);
+                break;
+            case 'm':
+                min_size = strtoull(optarg, nullptr, 0);
+                break;
+            case 'M':
+                max_size = strtoull(optarg, nullptr, 0);
+                break;
+            case 'a':
+                max_assoc = strtoul(optarg, nullptr, 0);
+                break;
+            default:
+                print_help();
+                return 0;
+        }
+    }
+    bool pow2 = line_size && min_size && max_assoc && !(line_size & (line_size-1)) &&
+                !(min_size & (min_size-1)) && !(max_size & (max_size-1)) && !(max_assoc & (max_assoc-1));
+    if (!path || !pow2 || min_size < line_size || max_size < min_size || max_size / line_size > (1u << 24)) {
+        cout << "Invalid options\n";
+        print_help();
+        return 1;
+    }
+
+    MemoryTraceReader reader;
+    if (!reader.open(path)) {
+        cout << "Failed to read memory trace: " << path << "\n";
+        return 1;
+    }
+
+    // Set counts from the smallest size at the highest associativity to the largest direct-mapped
+    int line_bits = log2i(line_size);
+    int first = max(0, log2i(min_size / line_size) - log2i(max_assoc));
+    int last = log2i(max_size / line_size);
+    vector<SetStacks> stacks;
+    for (int s = first; s <= last; s++) {
+        stacks.push_back({1u << s, vector<uint32_t>((size_t)max_assoc << s, EMPTY), vector<uint64_t>(max_assoc, 0)});
+    }
+
+    // Fully associative hits by distance bucket: bucket k holds distances in [2^(k-1), 2^k),
+    // bucket 0 distance 0; a cache of 2^k lines hits buckets 0..k
+    vector<uint64_t> buckets(34, 0);
+    StackDistance distance;
+    uint64_t accesses = 0, writes = 0;
+
+    MemoryTraceRecord r;
+    while (reader.next(r)) {
+        uint32_t line = r.address >> line_bits;
+        accesses++;
+        writes += r.write;
+
+        int64_t d = distance.access(line);
+        if (d >= 0) {
+            buckets[d ? log2i(d) + 1 : 0]++;
+        }
+
+        for (SetStacks &st : stacks) {
+            uint32_t *set = &st.tags[(size_t)(line & (st.sets - 1)) * max_assoc];
+            uint32_t depth = 0;
+            while (depth < max_assoc - 1 && set[depth] != line) {
+                depth++;
+            }
+            if (set[depth] == line) {
+                st.hits[depth]++;
+            }
+            for (; depth > 0; depth--) {
+                set[depth] = set[depth - 1];
+            }
+            set[0] = line;
+        }
+    }
+
+    cout << "Accesses: " << accesses << " reads: " << accesses - writes << " writes: " << writes
+         << " distinct lines: " << distance.lines() << "\n";
+    if (!accesses) {
+        return 0;
+    }
+
+    cout << "\nFully associative LRU, " << line_size << "-byte lines\n";
+    cout << "size,miss_ratio\n";
+    uint64_t hits = 0;
+    for (int k = 0; k <= last; k++) {
+        hits += buckets[k];
+        if (((uint64_t)line_size << k) >= min_size) {
+            printf("%llu,%.6f\n", (unsigned long long)line_size << k, 1.0 - (double)hits / accesses);
+        }
+    }
+
+    cout << "\nSet-associative LRU, " << line_size << "-byte lines\n";
+    cout << "size";
+    for (uint32_t a = 1; a <= max_assoc; a *= 2) {
+        cout << "," << a << "-way";
+    }
+    cout << "\n";
+    for (uint64_t size = min_size; size <= max_size; size *= 2) {
+        cout << size;
+        for (uint32_t a = 1; a <= max_assoc; a *= 2) {
+            uint64_t sets = size / ((uint64_t)line_size * a);
+            if (!sets) {
+                cout << ",-";
+                continue;
+            }
+            SetStacks &st = stacks[log2i(sets) - first];
+            uint64_t set_hits = 0;
+            for (uint32_t d = 0; d < a; d++) {
+                set_hits += st.hits[d];
+            }
+            printf(",%.6f", 1.0 - (double)set_hits / accesses);
+        }
+        cout << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "memory.h"
+#include "processor.h"
+#include "interval.h"
+
+using namespace std;
+
+/* Regression checks run by make check: each one sets up a hierarchy or a short program in
+   memory, runs it and compares one result with the value it must have. */
+
+static int failures = 0;
+
+static void check(bool ok, const string &what) {
+    cout << (ok ? "PASS: " : "FAIL: ") << what << "\n";
+    failures += !ok;
+}
+
+// Cycles until a load of a line no level holds yet completes, 0 if it never does
+static uint64_t coldMissCycles(const HierarchyConfig &config, uint32_t address) {
+    Memory memory(1, config);
+    memory.setOptLevel(1);
+    uint32_t data = 0;
+    for (uint64_t cycles = 1; cycles < 100000; cycles++) {
+        if (memory.access(address, data, 0, true, false)) {
+            return cycles;
+        }
+        memory.tick();
+    }
+    return 0;
+}
+
+// Load the first words of each of the lines from address 0 on, one load at a time on thread 0
+static void streamLoads(Memory &memory, int lines, int words) {
+    uint32_t data = 0;
+    for (int i = 0; i < lines; i++) {
+        for (int w = 0; w < words; w++) {
+            while (!memory.access(i*64 + w*4, data, 0, true, false)) {
+                memory.tick();
+            }
+            memory.tick();
+        }
+    }
+}
+
+// A refill is one miss in every level it passes, however long the requester waits for it
+static void missCounts() {
+    HierarchyConfig config;
+    config.dram.banks = 8;
+    Memory memory(1, config);
+    memory.setOptLevel(1);
+    streamLoads(memory, 256, 1);
+    const CacheStats &l1d = memory.getL1DStats(0);
+    const CacheStats &l2 = memory.getLevelStats(0);
+    check(l1d.hits == 0 && l1d.misses == 256, "cold stream: L1D hits " + to_string(l1d.hits) + " misses " + to_string(l1d.misses));
+    check(l2.hits == 0 && l2.misses == 256, "cold stream with DRAM: L2 hits " + to_string(l2.hits) + " misses " + to_string(l2.misses));
+}
+
+// More cores than L2 ways missing in one set at once: each fill into the L2 evicts the line of
+// another core, which must still reach its L1 instead of missing again
+static void sharedSetContention() {
+    HierarchyConfig config;
+    config.levels[0].size = 4096;
+    config.levels[0].assoc = 2;
+    const int cores = 3;
+    Memory memory(cores, config);
+    memory.setOptLevel(1);
+    vector<bool> done(cores, false);
+    int completed = 0;
+    for (int cycle = 0; cycle < 10000 && completed < cores; cycle++) {
+        for (int c = 0; c < cores; c++) {
+            uint32_t data = 0;
+            // the L2 has 32 sets of 64-byte lines: 2KB apart lands in the same set
+            if (!done[c] && memory.access(0x10000 + 2048*c, data, 0, true, false, c)) {
+                done[c] = true;
+                completed++;
+            }
+            memory.tick(c);
+        }
+    }
+    check(completed == cores, to_string(cores) + " cores missing in one set of a 2-way L2: " + to_string(completed) + " completed");
+}
+
+// Column of the first sample in an interval CSV file, -1 if there is none
+static double sampled(const char *path, int column) {
+    ifstream in(path);
+    string header, sample;
+    if (!getline(in, header) || !getline(in, sample)) {
+        return -1;
+    }
+    for (int c = 0; c < column; c++) {
+        sample = sample.substr(sample.find(',') + 1);
+    }
+    return stod(sample);
+}
+
+// Interval miss rates of a stream touching every line once, or every word of each line
+static void intervalMissRates() {
+    const char *path = "check_intervals.csv";
+    for (int words : {1, 16}) {
+        Memory memory(1);
+        memory.setOptLevel(1);
+        vector<Processor> cores(1, Processor(&memory));
+        IntervalSampler sampler;
+        if (!sampler.open(path, 1000000, false, cores, memory)) {
+            check(false, string("open ") + path);
+            return;
+        }
+        streamLoads(memory, 256, words);
+        sampler.sample(1);
+        sampler.close();
+        double l1d = sampled(path, 7);
+        double l2 = sampled(path, 8);
+        string stream = words == 1 ? "compulsory stream" : "stream of whole lines";
+        check(l1d == 1.0/words, stream + ": L1D miss rate " + to_string(l1d));
+        check(l2 == 1.0, stream + ": L2 miss rate " + to_string(l2));
+    }
+    remove(path);
+}
+
+// Write a program from address 0 of thread 0, as the loader does
+static void loadProgram(Memory &memory, const vector<uint32_t> &code) {
+    uint32_t dummy = 0;
+    for (int i = 0; i < (int)code.size(); i++) {
+        memory.access(4*i, dummy, code[i], false, true);
+    }
+}
+
+static uint32_t I(int opcode, int rs, int rt, uint32_t imm) {
+    return (opcode << 26) | (rs << 21) | (rt << 16) | (imm & 0xffff);
+}
+
+// Run a program of thread 0 to its end in one timing model
+template <TimingModel Model>
+static void runProgram(Memory &memory, Processor &core, vector<uint32_t> code, int opt_level) {
+    // the pipelined models stop fetching at the end: let the last instructions drain
+    code.resize(code.size() + 8, 0);
+    loadProgram(memory, code);
+    core.initialize(opt_level);
+    memory.setOptLevel(opt_level);
+    for (int i = 0; i < 10000 && core.getPC() <= 4*code.size(); i++) {
+        core.advance<Model, NoTrace>();
+    }
+}
+
+// Sub-word loads and stores act on the byte or halfword their address selects (little-endian)
+static void subwordLanes() {
+    const uint32_t word = 0x8a7b6c5d;
+    vector<uint32_t> code = {
+        I(0xf, 0, 1, word >> 16),           // lui $1, 0x8a7b
+        I(0xd, 1, 1, word & 0xffff),        // ori $1, $1, 0x6c5d
+        I(0x2b, 0, 1, 0x100)                // sw $1, 0x100($0)
+    };
+    // lb, lbu of each byte and lh, lhu of each halfword, stored from 0x200 on
+    struct Load { int opcode; int offset; uint32_t value; const char *name; };
+    vector<Load> loads = {
+        {0x20, 0, 0x5d, "lb"}, {0x20, 1, 0x6c, "lb"}, {0x20, 2, 0x7b, "lb"}, {0x20, 3, 0xffffff8a, "lb"},
+        {0x24, 0, 0x5d, "lbu"}, {0x24, 1, 0x6c, "lbu"}, {0x24, 2, 0x7b, "lbu"}, {0x24, 3, 0x8a, "lbu"},
+        {0x21, 0, 0x6c5d, "lh"}, {0x21, 2, 0xffff8a7b, "lh"}, {0x25, 0, 0x6c5d, "lhu"}, {0x25, 2, 0x8a7b, "lhu"}
+    };
+    for (int i = 0; i < (int)loads.size(); i++) {
+        code.push_back(I(loads[i].opcode, 0, 2, 0x100 + loads[i].offset));
+        code.push_back(I(0x2b, 0, 2, 0x200 + 4*i));
+    }
+    // sb into byte 1 and sh into halfword 1 of a copy of the word at 0x300
+    code.push_back(I(0x2b, 0, 1, 0x300));   // sw $1, 0x300($0)
+    code.push_back(I(0x9, 0, 3, 0x11));     // addiu $3, $0, 0x11
+    code.push_back(I(0x28, 0, 3, 0x301));   // sb $3, 0x301($0)
+    code.push_back(I(0x9, 0, 3, 0x2233));   // addiu $3, $0, 0x2233
+    code.push_back(I(0x29, 0, 3, 0x302));   // sh $3, 0x302($0)
+
+    for (TimingModel timing : {SINGLE_CYCLE, FIVE_STAGE, SCOREBOARD}) {
+        Memory memory(1);
+        Processor core(&memory);
+        core.setScoreboard(timing == SCOREBOARD);
+        if (timing == SINGLE_CYCLE) {
+            runProgram<SINGLE_CYCLE>(memory, core, code, 0);
+        } else if (timing == FIVE_STAGE) {
+            runProgram<FIVE_STAGE>(memory, core, code, 1);
+        } else {
+            runProgram<SCOREBOARD>(memory, core, code, 1);
+        }
+        string model = timing == SINGLE_CYCLE ? "-O0: " : timing == FIVE_STAGE ? "-O1: " : "--scoreboard: ";
+        uint32_t data = 0;
+        for (int i = 0; i < (int)loads.size(); i++) {
+            for (int c = 0; c < 1000 && !memory.access(0x200 + 4*i, data, 0, true, false); c++) {
+                memory.tick();
+            }
+            check(data == loads[i].value, model + loads[i].name + " at offset " + to_string(loads[i].offset) + " of 0x8a7b6c5d gives " + to_string(data));
+        }
+        for (int c = 0; c < 1000 && !memory.access(0x300, data, 0, true, false); c++) {
+            memory.tick();
+        }
+        check(data == 0x2233115d, model + "sb 0x11 at offset 1 and sh 0x2233 at offset 2 of 0x8a7b6c5d give " + to_string(data));
+    }
+}
+
+// --roi executes functionally up to the begin marker: jumps on the way must reach their targets
+static void roiJumps() {
+    vector<uint32_t> code = {
+        0x24020001,     // 0x00: addiu $2, $0, 1
+        0x08000004,     // 0x04: j 0x10
+        0x24020063,     // 0x08: addiu $2, $0, 99 (skipped)
+        0x24020063,     // 0x0c: addiu $2, $0, 99 (skipped)
+        0x0c000008,     // 0x10: jal 0x20, returns to 0x18
+        0x24020063,     // 0x14: addiu $2, $0, 99 (skipped)
+        0x24000001,     // 0x18: addiu $0, $0, 1 (begin marker)
+        0x24000002,     // 0x1c: addiu $0, $0, 2 (end marker)
+        0x24030005,     // 0x20: addiu $3, $0, 5
+        0x03e00008      // 0x24: jr $31
+    };
+    Memory memory(1);
+    loadProgram(memory, code);
+    Processor core(&memory);
+    core.initialize(0);
+    core.setROI(true);
+    bool entered = false;
+    for (int i = 0; i < 20 && !entered; i++) {
+        core.advance<SINGLE_CYCLE, NoTrace>();
+        entered = core.takeMarker() == MARKER_ROI_BEGIN;
+    }
+    check(entered && core.getPC() == 0x1c && core.getStats().retired == 6,
+          "fast-forward through j and jal reaches the begin marker after " + to_string(core.getStats().retired) + " instructions");
+}
+
+// A line from memory bypasses an exclusive level, but only after the lookup that missed there
+static void exclusiveColdMiss() {
+    HierarchyConfig inclusive;
+    HierarchyConfig exclusive;
+    exclusive.levels[0].inclusion = EXCLUSIVE;
+    uint64_t in = coldMissCycles(inclusive, 0x1000);
+    uint64_t ex = coldMissCycles(exclusive, 0x1000);
+    check(in && in == ex, "cold miss through an exclusive L2 takes " + to_string(ex) + " cycles, inclusive " + to_string(in));
+
+    inclusive.levels.push_back({"L3", 2097152, 16, 64, 120, INCLUSIVE, "lru", {true, true, 1, 0}, 0});
+    exclusive = inclusive;
+    exclusive.levels[1].inclusion = EXCLUSIVE;
+    in = coldMissCycles(inclusive, 0x1000);
+    ex = coldMissCycles(exclusive, 0x1000);
+    check(in && in == ex, "cold miss through an exclusive L3 takes " + to_string(ex) + " cycles, inclusive " + to_string(in));
+}
+
+int main() {
+    missCounts();
+    sharedSetContention();
+    intervalMissRates();
+    roiJumps();
+    subwordLanes();
+    exclusiveColdMiss();
+    cout << (failures ? to_string(failures) + " check(s) failed\n" : "All checks passed\n");
+    return failures ? 1 : 0;
+}
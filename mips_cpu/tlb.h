@@ -0,0 +1,112 @@
+#ifndef TLB
+#define TLB
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <memory>
+#include "replacement.h"
+
+// Geometry of one TLB
+struct TlbConfig {
+    std::string name;
+    int entries;                 // 0 disables the TLB (L2 TLB only)
+    int assoc;
+    int latency;                 // cycles of a lookup after a miss in the level above (L2 TLB only)
+};
+
+// Virtual memory: per-core L1 I/D TLBs, a shared L2 TLB and two-level page tables
+struct VirtualMemoryConfig {
+    bool enabled;                // 0: addresses are physical (offset by the thread's region)
+    int pageSize;
+    TlbConfig itlb;
+    TlbConfig dtlb;
+    TlbConfig l2tlb;
+};
+
+struct TlbStats {
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Set-associative TLB with LRU replacement. Entries are tagged with an address space id, so
+// hardware threads running different images can share one TLB.
+class Tlb {
+    private:
+        struct Entry {
+            bool valid;
+            int asid;
+            uint32_t vpn;
+            uint32_t pfn;
+        };
+        std::string name;
+        std::vector<Entry> entry;
+        int assoc;
+        int numSets;
+        int latency;
+        std::unique_ptr<ReplacementPolicy> repl;
+        TlbStats stats;
+
+        // Location of the valid entry translating this page, -1 if absent
+        int find(int asid, uint32_t vpn) {
+            int set = vpn & (numSets-1);
+            for (int w = 0; w < assoc; w++) {
+                Entry &e = entry[set*assoc+w];
+                if (e.valid && e.vpn == vpn && e.asid == asid) {
+                    return set*assoc+w;
+                }
+            }
+            return -1;
+        }
+    public:
+        Tlb(const TlbConfig &config) : name(config.name), latency(config.latency), stats() {
+            assoc = config.entries ? std::min(config.assoc, config.entries) : 1;
+            numSets = config.entries ? config.entries/assoc : 0;
+            entry.resize(config.entries, Entry());
+            repl.reset(numSets ? makeReplacementPolicy("lru", numSets, assoc) : nullptr);
+        }
+        bool enabled() { return numSets > 0; }
+        int getLatency() { return latency; }
+
+        // Translate a virtual page number, updating the replacement state on a hit
+        bool lookup(int asid, uint32_t vpn, uint32_t &pfn) {
+            int loc = enabled() ? find(asid, vpn) : -1;
+            if (loc < 0) {
+                return false;
+            }
+            repl->touch(loc/assoc, loc%assoc);
+            pfn = entry[loc].pfn;
+            return true;
+        }
+
+        // Install a translation, preferring an invalid way over the LRU one
+        void insert(int asid, uint32_t vpn, uint32_t pfn) {
+            if (!enabled() || find(asid, vpn) >= 0) {
+                return;
+            }
+            int set = vpn & (numSets-1);
+            int way = -1;
+            for (int w = 0; w < assoc && way < 0; w++) {
+                way = entry[set*assoc+w].valid ? -1 : w;
+            }
+            if (way < 0) {
+                way = repl->victim(set);
+            }
+            entry[set*assoc+way] = {true, asid, vpn, pfn};
+            repl->insert(set, way);
+        }
+
+        void countHit() { stats.hits++; }
+        void countMiss() { stats.misses++; }
+        const TlbStats &getStats() { return stats; }
+        void resetStats() { stats = TlbStats(); }
+
+        void printStats() {
+            std::cout << name << " hits: " << stats.hits << " misses: " << stats.misses;
+            if (stats.hits + stats.misses) {
+                std::cout << " hit rate: " << (double)stats.hits / (stats.hits + stats.misses);
+            }
+            std::cout << "\n";
+        }
+};
+#endif
@@ -0,0 +1,93 @@
+#ifndef VALUEPRED
+#define VALUEPRED
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+struct ValuePredictorStats {
+    uint64_t loads;              // loads that looked up the table
+    uint64_t predicted;          // lookups confident enough to predict
+    uint64_t correct;            // predictions that matched the loaded value
+    uint64_t replays;            // mispredictions a dependent had already used
+};
+
+// Stride load value predictor, a direct-mapped table indexed by the load's PC. Each entry
+// keeps the last value loaded and the last stride; last-value prediction is the zero-stride
+// case. A saturating counter counts repeats of the stride and the table predicts
+// last + stride once it reaches the threshold; a different stride resets it.
+class LoadValuePredictor {
+    private:
+        enum { CONFIDENCE_MAX = 3 };
+        struct Entry {
+            uint32_t pc;
+            uint32_t last;
+            uint32_t stride;
+            int confidence;
+            bool valid;
+        };
+        std::vector<Entry> table;
+        int threshold;
+        ValuePredictorStats stats;
+
+        Entry &lookup(uint32_t pc) { return table[(pc/4) % table.size()]; }
+    public:
+        LoadValuePredictor() : threshold(CONFIDENCE_MAX) {
+            stats = ValuePredictorStats();
+        }
+
+        void configure(int entries, int confidence) {
+            table.assign(entries, Entry());
+            threshold = std::min(std::max(confidence, 1), (int)CONFIDENCE_MAX);
+        }
+        bool enabled() { return !table.empty(); }
+
+        // A load at pc issues: true and the predicted value if the entry is confident
+        bool predict(uint32_t pc, uint32_t &value) {
+            stats.loads++;
+            Entry &e = lookup(pc);
+            if (!e.valid || e.pc != pc || e.confidence < threshold) {
+                return false;
+            }
+            value = e.last + e.stride;
+            stats.predicted++;
+            return true;
+        }
+
+        // The load at pc returned value; predicted tells whether it was predicted as guess
+        void update(uint32_t pc, uint32_t value, bool predicted, uint32_t guess) {
+            if (predicted && value == guess) {
+                stats.correct++;
+            }
+            Entry &e = lookup(pc);
+            if (!e.valid || e.pc != pc) {
+                e = {pc, value, 0, 0, true};
+                return;
+            }
+            uint32_t stride = value - e.last;
+            if (stride == e.stride) {
+                e.confidence = std::min(e.confidence + 1, (int)CONFIDENCE_MAX);
+            } else {
+                e.stride = stride;
+                e.confidence = 0;
+            }
+            e.last = value;
+        }
+
+        void countReplay() { stats.replays++; }
+
+        void resetStats() { stats = ValuePredictorStats(); }
+
+        void printStats() {
+            std::cout << "Value predictor loads: " << stats.loads << " predicted: " << stats.predicted
+                      << " correct: " << stats.correct << " replays: " << stats.replays;
+            if (stats.loads) {
+                std::cout << " coverage: " << (double)stats.predicted / stats.loads;
+            }
+            if (stats.predicted) {
+                std::cout << " accuracy: " << (double)stats.correct / stats.predicted;
+            }
+            std::cout << "\n";
+        }
+};
+#endif
@@ -0,0 +1,362 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <elf.h>
+#include <getopt.h>
+
+using namespace std;
+
+/* Synthetic workload generator: writes a benchmark executable for the simulator. The program
+   is one loop whose body is drawn from an instruction mix; the knobs control the dependency
+   chains between ALU results (ILP), how often and how predictably branches are taken, and the
+   footprint and stride of the loads and stores. The same seed always gives the same program. */
+
+// Registers used by the generated code
+enum {
+    TMP = 1,            // branch conditions
+    CHAIN0 = 2,         // $2-$9 carry the dependency chains
+    NUM_CHAINS = 8,
+    ADDR = 10,          // address of the current access
+    LOADED = 11,        // loaded value, folded into a chain
+    SKIP = 12,          // target of the instructions branches skip over
+    BASE = 16,          // start of the working set
+    MASK = 17,          // footprint - 1, word aligned
+    OFFSET = 18,        // current offset into the working set
+    LFSR = 19,          // xorshift state, advanced once per iteration
+    COUNT = 20,         // remaining iterations
+    LFSR_TMP = 21
+};
+
+static const uint32_t DATA_BASE = 0x100000;     // the working set starts at 1MB
+
+struct WorkloadConfig {
+    int body;                   // operations in the loop body
+    uint32_t iterations;
+    int mix[5];                 // weights of alu, mul, load, store, branch operations
+    int chainLength;            // ALU results feeding each other before a new chain starts
+    double takenRate;           // fraction of branches taken
+    double predictability;      // fraction of branch sites with a fixed outcome
+    uint32_t footprint;         // bytes of data touched, a power of two
+    int stride;                 // bytes between consecutive accesses
+    bool randomAccess;          // random offsets instead of the stride
+    uint32_t seed;
+    bool roi;                   // mark the loop as the region of interest
+};
+
+static uint32_t R(int rs, int rt, int rd, int shamt, int funct) {
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+static uint32_t I(int opcode, int rs, int rt, uint32_t imm) {
+    return (opcode << 26) | (rs << 21) | (rt << 16) | (imm & 0xffff);
+}
+
+class Generator {
+    private:
+        WorkloadConfig config;
+        vector<uint32_t> code;
+        uint32_t state;
+        int chain;              // register of the current chain
+        int chainUsed;          // operations already in it
+        int shift;              // LFSR bits the next random branch or access looks at
+
+        uint32_t random() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        void emit(uint32_t instruction) { code.push_back(instruction); }
+
+        // Load a 32-bit constant
+        void constant(int reg, uint32_t value) {
+            emit(I(0xf, 0, reg, value >> 16));          // lui
+            emit(I(0xd, reg, reg, value & 0xffff));     // ori
+        }
+
+        // Register of the chain the next operation extends
+        int chainRegister() {
+            if (chainUsed == config.chainLength) {
+                chain = CHAIN0 + (chain - CHAIN0 + 1) % NUM_CHAINS;
+                chainUsed = 0;
+            }
+            chainUsed++;
+            return chain;
+        }
+
+        void alu() {
+            int d = chainRegister();
+            switch (random() % 8) {
+                case 0: emit(R(d, LFSR, d, 0, 0x21)); break;            // addu
+                case 1: emit(R(d, LFSR, d, 0, 0x23)); break;            // subu
+                case 2: emit(R(d, LFSR, d, 0, 0x26)); break;            // xor
+                case 3: emit(R(d, LFSR, d, 0, 0x2a)); break;            // slt
+                case 4: emit(R(0, d, d, 1 + random() % 4, 0x02)); break;// srl
+                case 5: emit(I(0x9, d, d, random())); break;            // addiu
+                case 6: emit(I(0xe, d, d, random())); break;            // xori
+                default: emit(R(0, d, d, 1 + random() % 4, 0x00));      // sll
+            }
+        }
+
+        void mul() {
+            int d = chainRegister();
+            emit(R(d, LFSR, 0, 0, 0x19));               // multu
+            emit(R(0, 0, d, 0, 0x12));                  // mflo
+        }
+
+        // Next address of the working set into ADDR
+        void address() {
+            if (config.randomAccess) {
+                emit(R(0, LFSR, OFFSET, shift++ % 16, 0x02));   // srl
+            } else {
+                emit(I(0x9, OFFSET, OFFSET, config.stride));    // addiu
+            }
+            emit(R(OFFSET, MASK, OFFSET, 0, 0x24));             // and
+            emit(R(BASE, OFFSET, ADDR, 0, 0x21));               // addu
+        }
+
+        void load() {
+            address();
+            int d = chainRegister();
+            emit(I(0x23, ADDR, LOADED, 0));             // lw
+            emit(R(d, LOADED, d, 0, 0x21));             // addu
+        }
+
+        void store() {
+            address();
+            emit(I(0x2b, ADDR, chain, 0));              // sw
+        }
+
+        // A forward branch over one instruction: fixed outcome, or taken when random LFSR bits
+        // fall below the taken rate
+        void branch() {
+            if (random() % 1000 < config.predictability * 1000) {
+                bool taken = random() % 1000 < config.takenRate * 1000;
+                emit(I(taken ? 0x4 : 0x5, 0, 0, 1));                    // beq/bne $0, $0
+            } else {
+                uint32_t threshold = (uint32_t)(config.takenRate * 256);
+                emit(R(0, LFSR, TMP, shift++ % 24, 0x02));              // srl
+                emit(I(0xc, TMP, TMP, 0xff));                           // andi
+                emit(I(0xb, TMP, TMP, threshold));                      // sltiu
+                emit(I(0x5, TMP, 0, 1));                                // bne
+            }
+            emit(I(0x9, SKIP, SKIP, 1));                                // addiu
+        }
+    public:
+        Generator(const WorkloadConfig &c) : config(c), state(c.seed ? c.seed : 1), chain(CHAIN0), chainUsed(0), shift(0) {}
+
+        vector<uint32_t> &generate() {
+            constant(BASE, DATA_BASE);
+            constant(MASK, (config.footprint - 1) & ~3u);
+            constant(LFSR, random() | 1);
+            constant(COUNT, config.iterations);
+
+            int total = 0;
+            for (int i = 0; i < 5; i++) {
+                total += config.mix[i];
+            }
+            if (config.roi) {
+                emit(I(0x9, 0, 0, 1));                  // addiu $zero, $zero, 1: ROI begin
+            }
+            uint32_t loop = code.size();
+
+            // xorshift the LFSR: the random branches and accesses of this iteration read it
+            emit(R(0, LFSR, LFSR_TMP, 13, 0x00));
+            emit(R(LFSR, LFSR_TMP, LFSR, 0, 0x26));
+            emit(R(0, LFSR, LFSR_TMP, 17, 0x02));
+            emit(R(LFSR, LFSR_TMP, LFSR, 0, 0x26));
+            emit(R(0, LFSR, LFSR_TMP, 5, 0x00));
+            emit(R(LFSR, LFSR_TMP, LFSR, 0, 0x26));
+
+            for (int i = 0; i < config.body; i++) {
+                int pick = random() % total;
+                if ((pick -= config.mix[0]) < 0) {
+                    alu();
+                } else if ((pick -= config.mix[1]) < 0) {
+                    mul();
+                } else if ((pick -= config.mix[2]) < 0) {
+                    load();
+                } else if ((pick -= config.mix[3]) < 0) {
+                    store();
+                } else {
+                    branch();
+                }
+            }
+
+            emit(I(0x9, COUNT, COUNT, -1));                                         // addiu
+            emit(I(0x5, COUNT, 0, loop - code.size() - 1));                         // bne
+            if (config.roi) {
+                emit(I(0x9, 0, 0, 2));                  // addiu $zero, $zero, 2: ROI end
+            }
+            for (int i = 0; i < 4; i++) {
+                emit(0);
+            }
+            return code;
+        }
+};
+
+/* Write the code as the .text section of an ELF executable at address 0, as the loader expects. */
+bool write_elf(const char *path, const vector<uint32_t> &code)
+{
+    const char strtab[] = "\0.text\0.shstrtab";
+    uint32_t text_size = code.size() * 4;
+
+    Elf32_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_MIPS;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr.e_shnum = 3;
+    ehdr.e_shstrndx = 2;
+    ehdr.e_shoff = sizeof(Elf32_Ehdr) + text_size + sizeof(strtab);
+
+    Elf32_Shdr shdr[3];
+    memset(shdr, 0, sizeof(shdr));
+    shdr[1].sh_name = 1;
+    shdr[1].sh_type = SHT_PROGBITS;
+    shdr[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    shdr[1].sh_offset = sizeof(Elf32_Ehdr);
+    shdr[1].sh_size = text_size;
+    shdr[1].sh_addralign = 4;
+    shdr[2].sh_name = 7;
+    shdr[2].sh_type = SHT_STRTAB;
+    shdr[2].sh_offset = sizeof(Elf32_Ehdr) + text_size;
+    shdr[2].sh_size = sizeof(strtab);
+    shdr[2].sh_addralign = 1;
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        cout << "Failed to open output file: " << path << "\n";
+        return false;
+    }
+    fwrite(&ehdr, sizeof(ehdr), 1, out);
+    fwrite(code.data(), 4, code.size(), out);
+    fwrite(strtab, sizeof(strtab), 1, out);
+    fwrite(shdr, sizeof(shdr), 1, out);
+    fclose(out);
+    return true;
+}
+
+void print_help()
+{
+    cout << "Usage: workload --out <path> [options]\n"
+            "--out <path>                         Executable to write\n"
+            "--body <ops>                         Operations in the loop body (default 64)\n"
+            "--iterations <n>                     Loop iterations (default 1000)\n"
+            "--mix <alu>,<mul>,<load>,<store>,<branch>\n"
+            "                                     Weights of the operation kinds (default 50,5,20,10,15)\n"
+            "--chain-length <n>                   ALU results feeding each other before a new chain\n"
+            "                                     starts; 1 makes neighbouring operations independent (default 4)\n"
+            "--taken-rate <f>                     Fraction of branches taken (default 0.5)\n"
+            "--predictability <f>                 Fraction of branch sites with a fixed outcome; the others\n"
+            "                                     depend on random bits every iteration (default 0.5)\n"
+            "--footprint <bytes>                  Working set of the loads and stores, a power of two (default 65536)\n"
+            "--stride <bytes>                     Distance between consecutive accesses (default 4)\n"
+            "--random-access                      Random word offsets in the working set instead of the stride\n"
+            "--seed <n>                           Seed of the generator (default 1)\n"
+            "--roi                                Put region of interest markers around the loop\n";
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+      {"out", required_argument, 0, 'o'},
+      {"body", required_argument, 0, 'b'},
+      {"iterations", required_argument, 0, 'i'},
+      {"mix", required_argument, 0, 'm'},
+      {"chain-length", required_argument, 0, 'c'},
+      {"taken-rate", required_argument, 0, 't'},
+      {"predictability", required_argument, 0, 'p'},
+      {"footprint", required_argument, 0, 'f'},
+      {"stride", required_argument, 0, 's'},
+      {"random-access", no_argument, 0, 'r'},
+      {"seed", required_argument, 0, 'S'},
+      {"roi", no_argument, 0, 'g'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}
+    };
+    WorkloadConfig config = {64, 1000, {50, 5, 20, 10, 15}, 4, 0.5, 0.5, 65536, 4, false, 1, false};
+    const char *out = nullptr;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "h", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case 'o':
+                out = optarg;
+                break;
+            case 'b':
+                config.body = atoi(optarg);
+                break;
+            case 'i':
+                config.iterations = strtoul(optarg, nullptr, 0);
+                break;
+            case 'm':
+                if (sscanf(optarg, "%d,%d,%d,%d,%d", &config.mix[0], &config.mix[1], &config.mix[2], &config.mix[3], &config.mix[4]) != 5) {
+                    cout << "Invalid instruction mix: " << optarg << "\n";
+                    return 1;
+                }
+                break;
+            case 'c':
+                config.chainLength = atoi(optarg);
+                break;
+            case 't':
+                config.takenRate = atof(optarg);
+                break;
+            case 'p':
+                config.predictability = atof(optarg);
+                break;
+            case 'f':
+                config.footprint = strtoul(optarg, nullptr, 0);
+                break;
+            case 's':
+                config.stride = atoi(optarg);
+                break;
+            case 'r':
+                config.randomAccess = true;
+                break;
+            case 'S':
+                config.seed = strtoul(optarg, nullptr, 0);
+                break;
+            case 'g':
+                config.roi = true;
+                break;
+            default:
+                print_help();
+                return 0;
+        }
+    }
+
+    int total = 0;
+    for (int i = 0; i < 5; i++) {
+        total += config.mix[i] < 0 ? -1000 : config.mix[i];
+    }
+    if (!out || config.body < 1 || config.iterations < 1 || config.chainLength < 1 || total <= 0 ||
+        config.takenRate < 0 || config.takenRate > 1 || config.predictability < 0 || config.predictability > 1 ||
+        config.footprint < 4 || (config.footprint & (config.footprint - 1)) ||
+        DATA_BASE + config.footprint > 8*1024*1024 || config.stride < -32768 || config.stride > 32767) {
+        cout << "Invalid workload configuration\n";
+        print_help();
+        return 1;
+    }
+
+    Generator generator(config);
+    vector<uint32_t> &code = generator.generate();
+    if (!write_elf(out, code)) {
+        return 1;
+    }
+    cout << "Wrote " << code.size() << " instructions to " << out << "\n";
+    return 0;
+}